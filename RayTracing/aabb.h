@@ -0,0 +1,143 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+/// <summary>
+/// Axis-aligned bounding box
+/// </summary>
+class aabb
+{
+public:
+	point3 minimum;
+	point3 maximum;
+
+	/// <summary>
+	/// Construct an empty box that any union will overwrite
+	/// </summary>
+	aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+	aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+	point3 min() const { return minimum; }
+	point3 max() const { return maximum; }
+
+	bool empty() const { return minimum.x() > maximum.x(); }
+
+	point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+	/// <summary>
+	/// Surface area of the box, used as the hit probability in the SAH
+	/// </summary>
+	/// <returns>Surface area, 0 for an empty box</returns>
+	real surface_area() const
+	{
+		if (empty()) return 0.0;
+
+		vec3 d = maximum - minimum;
+		return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+	}
+
+	/// <summary>
+	/// Grow the box to contain a point
+	/// </summary>
+	/// <param name="p">Point to include</param>
+	void expand(const point3& p)
+	{
+		// Plain comparisons compile to min/max instructions, fmin/fmax do not
+		for (int a = 0; a < 3; ++a)
+		{
+			minimum[a] = p[a] < minimum[a] ? p[a] : minimum[a];
+			maximum[a] = p[a] > maximum[a] ? p[a] : maximum[a];
+		}
+	}
+
+	/// <summary>
+	/// Grow the box to contain another box
+	/// </summary>
+	/// <param name="box">Box to include</param>
+	void expand(const aabb& box)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			minimum[a] = box.minimum[a] < minimum[a] ? box.minimum[a] : minimum[a];
+			maximum[a] = box.maximum[a] > maximum[a] ? box.maximum[a] : maximum[a];
+		}
+	}
+
+	/// <summary>
+	/// Slab test against a ray
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <returns>True if the ray overlaps the box inside [t_min, t_max]</returns>
+	bool hit(const ray& r, real t_min, real t_max) const
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			auto inv_d = 1.0 / r.direction()[a];
+			auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+			auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+
+			if (inv_d < 0.0) std::swap(t0, t1);
+
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+
+			if (t_max <= t_min) return false;
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Slab test with the reciprocal direction precomputed by the caller,
+	/// which is what the BVH traversal uses for every node. The far distance
+	/// is padded by a few ulps (Ize, Robust BVH Ray Traversal, 2013) so that
+	/// rounding cannot cull a box the ray only grazes, e.g. at a vertex
+	/// shared by triangles in different leaves.
+	/// </summary>
+	/// <param name="origin">Ray origin</param>
+	/// <param name="inv_dir">Component-wise reciprocal of the ray direction</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <returns>True if the ray overlaps the box inside [t_min, t_max]</returns>
+	bool hit(const point3& origin, const vec3& inv_dir, real t_min, real t_max) const
+	{
+		// 1 + 2 * gamma(3), gamma(n) = n * eps / (1 - n * eps)
+		const real far_padding = 1.0 + 2.0 * 3.0 * std::numeric_limits<real>::epsilon() / (1.0 - 3.0 * std::numeric_limits<real>::epsilon());
+
+		for (int a = 0; a < 3; ++a)
+		{
+			auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+			auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+
+			if (inv_dir[a] < 0.0) std::swap(t0, t1);
+			t1 *= far_padding;
+
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+
+			if (t_max < t_min) return false;
+		}
+
+		return true;
+	}
+};
+
+/// <summary>
+/// Smallest box containing two boxes
+/// </summary>
+/// <param name="box0">First box</param>
+/// <param name="box1">Second box</param>
+/// <returns>Union of the boxes</returns>
+inline aabb surrounding_box(const aabb& box0, const aabb& box1)
+{
+	aabb box = box0;
+	box.expand(box1);
+	return box;
+}
+
+#endif // !AABB_H
@@ -0,0 +1,128 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "lights.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "render_settings.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+#include <vector>
+
+/// <summary>
+/// Feature buffers of the first hit seen through every pixel, averaged
+/// over a few camera samples: the surface albedo (the sky's color where
+/// nothing is hit), the shading normal (zero on a miss) and the distance
+/// along the ray (zero on a miss). They guide the denoiser and can be
+/// written out for external ones. Rows are ordered like the framebuffer's.
+/// </summary>
+struct aov_buffers
+{
+	int width = 0;
+	int height = 0;
+	std::vector<float> albedo; // RGB
+	std::vector<float> normal; // XYZ
+	std::vector<float> depth;
+
+	aov_buffers(int w, int h)
+		: width(w), height(h),
+		  albedo(static_cast<size_t>(w) * h * 3, 0.0f),
+		  normal(static_cast<size_t>(w) * h * 3, 0.0f),
+		  depth(static_cast<size_t>(w) * h, 0.0f)
+	{}
+
+	size_t index(int i, int j) const { return static_cast<size_t>(j) * width + i; }
+};
+
+/// <summary>
+/// Trace camera rays to their first hit and fill the feature buffers.
+/// Sample s of a pixel uses the same generator as sample s of the render,
+/// so the features are taken where the first samples landed.
+/// </summary>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings</param>
+/// <param name="pool">Worker threads</param>
+/// <param name="aovs">Buffers of the image's size to fill</param>
+/// <param name="samples">Camera rays per pixel</param>
+inline void render_aovs(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings,
+	thread_pool& pool, aov_buffers& aovs, int samples = 4)
+{
+	auto tiles = make_tiles(settings);
+	samples = std::max(1, samples);
+
+	pool.parallel_for(static_cast<int>(tiles.size()), [&](int index) {
+		const tile& t = tiles[index];
+
+		for (int j = t.y0; j < t.y1; ++j)
+		{
+			for (int i = t.x0; i < t.x1; ++i)
+			{
+				color albedo(0.0, 0.0, 0.0);
+				vec3 normal(0.0, 0.0, 0.0);
+				double depth = 0.0;
+
+				for (int s = 0; s < samples; ++s)
+				{
+					rng gen = pixel_rng(settings, i, j, s);
+
+					auto u = (i + random_double(gen)) / (settings.width - 1);
+					auto v = (j + random_double(gen)) / (settings.height - 1);
+
+					ray r = cam.get_ray(u, v, gen);
+					hit_record rec;
+					if (world.hit(r, 0.001, infinity, rec))
+					{
+						albedo += materials[rec.mat_id].albedo();
+						normal += rec.normal;
+						depth += rec.t * r.direction().length();
+					}
+					else
+					{
+						albedo += lights.sky(r);
+					}
+				}
+
+				size_t k = aovs.index(i, j);
+				for (int c = 0; c < 3; ++c)
+				{
+					aovs.albedo[k * 3 + c] = static_cast<float>(albedo[c] / samples);
+					aovs.normal[k * 3 + c] = static_cast<float>(normal[c] / samples);
+				}
+				aovs.depth[k] = static_cast<float>(depth / samples);
+			}
+		}
+	});
+}
+
+/// <summary>
+/// A framebuffer holding one sample per pixel, so that a finished image or
+/// a feature buffer can go through the image writers
+/// </summary>
+/// <param name="width">Image width</param>
+/// <param name="height">Image height</param>
+/// <param name="values">Pixel values, channels per pixel</param>
+/// <param name="channels">3 for color, 1 to repeat a value into gray</param>
+/// <returns>Framebuffer whose averages are the values</returns>
+inline framebuffer to_framebuffer(int width, int height, const std::vector<float>& values, int channels)
+{
+	framebuffer image(width, height);
+	for (size_t k = 0; k < image.counts.size(); ++k)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			image.pixels[k * 3 + c] = values[k * channels + (channels == 3 ? c : 0)];
+		}
+		image.counts[k] = 1;
+	}
+	return image;
+}
+
+#endif // !AOV_H
@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "random_scene.h"
+#include "render.h"
+#include "scene.h"
+#include "simd.h"
+#include "sphere.h"
+#include "thread_pool.h"
+
+/// <summary>
+/// Timing of one microbenchmark
+/// </summary>
+struct micro_result
+{
+	std::string name;
+	double ns_per_op;   // Median over the repetitions
+	double ns_min;      // Fastest repetition
+	uint64_t ops;       // Operations per repetition
+	int repetitions;
+};
+
+/// <summary>
+/// Timing of one render of random_scene
+/// </summary>
+struct render_result
+{
+	int grid;
+	size_t spheres;
+	int width, height, samples_per_pixel;
+	unsigned threads;
+	double scene_seconds;          // Generating the spheres
+	double build_seconds;          // Building the accelerator
+	double scene_bytes_per_sphere; // Spheres and materials
+	double accel_bytes_per_sphere; // What the accelerator adds
+	double render_seconds;         // Fastest of the repeats
+	uint64_t camera_rays;
+	uint64_t rays;                 // Every ray traced, counted only with RT_STATS
+};
+
+/// <summary>
+/// Benchmark parameters from the command line
+/// </summary>
+struct bench_options
+{
+	bool micro = true;
+	bool end_to_end = true;
+	double min_time = 0.25; // Seconds per microbenchmark repetition
+	int repetitions = 5;
+	int render_repeats = 1;
+	unsigned threads = 0;
+	std::vector<int> sizes = { 100, 10000, 1000000 };
+	std::vector<std::pair<int, int>> resolutions = { { 400, 266 } };
+	std::vector<int> spp = { 4 };
+	std::string output;
+};
+
+// Results are folded into this so the compiler cannot drop the work being timed
+static volatile double bench_sink = 0.0;
+
+/// <summary>
+/// Time body(i) for i = 0, 1, 2, ... First find how many calls take about
+/// min_time, then time that many calls repeatedly and keep the median.
+/// body returns a value that is added to a sink.
+/// </summary>
+template <typename Body>
+micro_result run_micro(const std::string& name, const bench_options& options, Body&& body)
+{
+	using clock = std::chrono::steady_clock;
+
+	auto time_ops = [&](uint64_t ops) {
+		double sum = 0.0;
+		auto start = clock::now();
+		for (uint64_t i = 0; i < ops; ++i)
+		{
+			sum += body(i);
+		}
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		bench_sink = bench_sink + sum;
+		return elapsed.count();
+	};
+
+	uint64_t ops = 1024;
+	double seconds = time_ops(ops);
+	while (seconds < options.min_time / 4 && ops < (uint64_t(1) << 40))
+	{
+		ops *= 2;
+		seconds = time_ops(ops);
+	}
+	ops = static_cast<uint64_t>(static_cast<double>(ops) * options.min_time / std::max(seconds, 1e-9)) + 1;
+
+	std::vector<double> ns;
+	for (int r = 0; r < options.repetitions; ++r)
+	{
+		ns.push_back(time_ops(ops) * 1e9 / static_cast<double>(ops));
+	}
+	std::sort(ns.begin(), ns.end());
+
+	micro_result result = { name, ns[ns.size() / 2], ns.front(), ops, options.repetitions };
+	std::cerr << name << ": " << result.ns_per_op << " ns/op" << std::endl;
+	return result;
+}
+
+/// <summary>
+/// Run every microbenchmark. Inputs are generated up front into small
+/// arrays that fit the cache, so the numbers are the cost of the routine.
+/// </summary>
+std::vector<micro_result> run_micro_benchmarks(const bench_options& options)
+{
+	const size_t input_count = 4096;
+	const size_t mask = input_count - 1;
+	rng gen(~0ull - 1);
+
+	// Rays from around the camera position towards the origin, with jitter
+	std::vector<ray> rays(input_count);
+	for (auto& r : rays)
+	{
+		point3 origin = point3(13.0, 2.0, 3.0) + vec3::random(-0.5, 0.5, gen);
+		vec3 target = vec3::random(-3.0, 3.0, gen);
+		r = ray(origin, target - origin);
+	}
+
+	// Hit records on a unit sphere, lit from outside and from inside
+	std::vector<ray> incoming(input_count);
+	std::vector<hit_record> hits(input_count);
+	for (size_t i = 0; i < input_count; ++i)
+	{
+		vec3 n = random_unit_vector(gen);
+		vec3 d = -n + 0.5 * random_unit_vector(gen);
+		hits[i].p = n;
+		hits[i].t = 1.0;
+		hits[i].mat_id = 0;
+		hits[i].set_face_normal(ray(n - d, d), n);
+		incoming[i] = ray(n - d, d);
+	}
+
+	std::vector<color> colors(input_count);
+	for (auto& c : colors)
+	{
+		c = color::random(gen);
+	}
+
+	std::vector<micro_result> results;
+
+	sphere ball(point3(0.0, 0.0, 0.0), 2.0, 0);
+	results.push_back(run_micro("sphere::hit", options, [&](uint64_t i) {
+		hit_record rec;
+		return ball.hit(rays[i & mask], 0.001, infinity, rec) ? rec.t : 0.0;
+	}));
+
+	material_table scene_materials;
+	packed_spheres packed = random_scene(scene_materials);
+	hittable_list list;
+	packed.to_list(list);
+	results.push_back(run_micro("hittable_list::hit (" + std::to_string(list.objects.size()) + " spheres)", options, [&](uint64_t i) {
+		hit_record rec;
+		return list.hit(rays[i & mask], 0.001, infinity, rec) ? rec.t : 0.0;
+	}));
+
+	// Any-hit queries of shadow rays against the same geometry
+	results.push_back(run_micro("sphere::occluded", options, [&](uint64_t i) {
+		return ball.occluded(rays[i & mask], 0.001, infinity) ? 1.0 : 0.0;
+	}));
+	results.push_back(run_micro("hittable_list::occluded (" + std::to_string(list.objects.size()) + " spheres)", options, [&](uint64_t i) {
+		return list.occluded(rays[i & mask], 0.001, infinity) ? 1.0 : 0.0;
+	}));
+
+	bvh_node tree(list);
+	results.push_back(run_micro("bvh_node::hit", options, [&](uint64_t i) {
+		hit_record rec;
+		return tree.hit(rays[i & mask], 0.001, infinity, rec) ? rec.t : 0.0;
+	}));
+	results.push_back(run_micro("bvh_node::occluded", options, [&](uint64_t i) {
+		return tree.occluded(rays[i & mask], 0.001, infinity) ? 1.0 : 0.0;
+	}));
+
+	packed_sphere_bvh packed_tree(packed);
+	results.push_back(run_micro("packed_sphere_bvh::hit", options, [&](uint64_t i) {
+		hit_record rec;
+		return packed_tree.hit(rays[i & mask], 0.001, infinity, rec) ? rec.t : 0.0;
+	}));
+	results.push_back(run_micro("packed_sphere_bvh::occluded", options, [&](uint64_t i) {
+		return packed_tree.occluded(rays[i & mask], 0.001, infinity) ? 1.0 : 0.0;
+	}));
+
+	const std::pair<const char*, material> materials[] = {
+		{ "lambertian::scatter", material(lambertian(color(0.5, 0.5, 0.5))) },
+		{ "metal::scatter", material(metal(color(0.7, 0.6, 0.5), 0.3)) },
+		{ "dielectric::scatter", material(dielectric(1.5)) },
+	};
+	for (const auto& m : materials)
+	{
+		results.push_back(run_micro(m.first, options, [&](uint64_t i) {
+			rng path(i);
+			color attenuation;
+			ray scattered;
+			bool kept = m.second.scatter(incoming[i & mask], hits[i & mask], attenuation, scattered, path);
+			return kept ? scattered.direction().x() : 0.0;
+		}));
+	}
+
+	results.push_back(run_micro("random_in_unit_sphere", options, [&](uint64_t) { return random_in_unit_sphere(gen).x(); }));
+	results.push_back(run_micro("random_unit_vector", options, [&](uint64_t) { return random_unit_vector(gen).x(); }));
+	results.push_back(run_micro("random_in_hemisphere", options, [&](uint64_t i) { return random_in_hemisphere(hits[i & mask].normal, gen).x(); }));
+	results.push_back(run_micro("random_in_unit_disk", options, [&](uint64_t) { return random_in_unit_disk(gen).x(); }));
+
+	const std::pair<const char*, sampler_kind> samplers[] = {
+		{ "sampler (independent)", sampler_kind::independent },
+		{ "sampler (stratified)", sampler_kind::stratified },
+		{ "sampler (sobol)", sampler_kind::sobol },
+		{ "sampler (halton)", sampler_kind::halton },
+		{ "sampler (blue-noise)", sampler_kind::blue_noise },
+	};
+	for (const auto& kind : samplers)
+	{
+		sample_pattern pattern;
+		pattern.kind = kind.second;
+		pattern.samples = 64;
+
+		// The four sampler dimensions of one bounce
+		results.push_back(run_micro(kind.first, options, [&](uint64_t i) {
+			pattern.x = static_cast<uint32_t>(i & 1023);
+			pattern.y = static_cast<uint32_t>(i >> 10);
+			rng path(i >> 6, static_cast<uint32_t>(i & 63), pattern);
+			path.set_bounce(static_cast<uint32_t>(i & 3));
+			return random_double(path) + random_double(path) + random_double(path) + random_double(path);
+		}));
+	}
+
+	results.push_back(run_micro("write_color", options, [&](uint64_t i) {
+		unsigned char out[3];
+		write_color(out, colors[i & mask]);
+		return static_cast<double>(out[0] + out[1] + out[2]);
+	}));
+
+	return results;
+}
+
+/// <summary>
+/// Lattice half-size of random_scene giving about the requested number of spheres
+/// </summary>
+int grid_for_spheres(int spheres)
+{
+	return std::max(1, static_cast<int>(std::lround(std::sqrt(static_cast<double>(spheres)) / 2.0)));
+}
+
+/// <summary>
+/// Render random_scene at every combination of size, resolution and
+/// sample count, through the same accelerator and render loop as the
+/// renderer's defaults
+/// </summary>
+std::vector<render_result> run_end_to_end(const bench_options& options)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::vector<render_result> results;
+	thread_pool pool(options.threads);
+
+	for (int size : options.sizes)
+	{
+		int grid = grid_for_spheres(size);
+
+		scene world;
+		auto scene_start = clock::now();
+		world.spheres = random_scene(world.materials, grid);
+		std::chrono::duration<double> scene_time = clock::now() - scene_start;
+
+		render_settings settings;
+		auto build_start = clock::now();
+		auto accel = build_accelerator(world, settings.accel);
+		std::chrono::duration<double> build_time = clock::now() - build_start;
+
+		double spheres = static_cast<double>(world.spheres.size());
+		double scene_bytes_per_sphere = scene_storage_bytes(world) / spheres;
+		double accel_bytes_per_sphere = accelerator_bytes(*accel, world) / spheres;
+		light_list lights = make_lights(world, settings.light_sampling);
+
+		for (const auto& resolution : options.resolutions)
+		{
+			for (int spp : options.spp)
+			{
+				settings.width = resolution.first;
+				settings.height = resolution.second;
+				settings.samples_per_pixel = spp;
+
+				camera_settings view = world.view;
+				view.aspect = static_cast<double>(settings.width) / settings.height;
+				camera cam = view.make_camera();
+
+				render_result result = { grid, world.spheres.size(), settings.width, settings.height, spp,
+					static_cast<unsigned>(pool.size()), scene_time.count(), build_time.count(),
+					scene_bytes_per_sphere, accel_bytes_per_sphere, 0.0, 0, 0 };
+
+				for (int repeat = 0; repeat < options.render_repeats; ++repeat)
+				{
+					framebuffer image(settings.width, settings.height);
+
+					RT_STAT(stats_registry::instance().reset());
+
+					auto start = clock::now();
+					render(*accel, world.materials, lights, cam, settings, pool, image);
+					std::chrono::duration<double> elapsed = clock::now() - start;
+
+					if (repeat == 0 || elapsed.count() < result.render_seconds) result.render_seconds = elapsed.count();
+					result.camera_rays = image.total_samples();
+					RT_STAT(result.rays = stats_registry::instance().total().total_rays());
+				}
+
+				std::cerr << result.spheres << " spheres, " << settings.width << "x" << settings.height << ", " << spp << " spp: "
+					<< static_cast<double>(result.camera_rays) / result.render_seconds / 1e6 << " Mrays/s" << std::endl;
+				results.push_back(result);
+			}
+		}
+	}
+
+	return results;
+}
+
+/// <summary>
+/// Write the results as JSON
+/// </summary>
+void write_json(std::ostream& out, const std::vector<micro_result>& micro, const std::vector<render_result>& renders)
+{
+	std::time_t now = std::time(nullptr);
+	char timestamp[32];
+	std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+#if defined(RT_SIMD_AVX)
+	const char* simd = "avx";
+#elif defined(RT_SIMD_SSE2)
+	const char* simd = "sse2";
+#else
+	const char* simd = "scalar";
+#endif
+
+#ifdef RT_STATS
+	const bool stats = true;
+#else
+	const bool stats = false;
+#endif
+
+#if defined(__clang__)
+	std::string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+	std::string compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+	std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#else
+	std::string compiler = "unknown";
+#endif
+
+	out << "{\n";
+	out << "  \"timestamp\": \"" << timestamp << "\",\n";
+	out << "  \"build\": { \"compiler\": \"" << compiler << "\", \"real\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double")
+		<< "\", \"simd\": \"" << simd << "\", \"simd_width\": " << simd_real::width << ", \"vec3_lanes\": " << RT_VEC3_LANES << ", \"stats\": " << (stats ? "true" : "false") << " },\n";
+
+	out << "  \"micro\": [";
+	for (size_t k = 0; k < micro.size(); ++k)
+	{
+		const micro_result& m = micro[k];
+		out << (k ? ",\n" : "\n") << "    { \"name\": \"" << m.name << "\", \"ns_per_op\": " << m.ns_per_op << ", \"ns_min\": " << m.ns_min
+			<< ", \"ops\": " << m.ops << ", \"repetitions\": " << m.repetitions << " }";
+	}
+	out << (micro.empty() ? "],\n" : "\n  ],\n");
+
+	out << "  \"end_to_end\": [";
+	for (size_t k = 0; k < renders.size(); ++k)
+	{
+		const render_result& r = renders[k];
+		out << (k ? ",\n" : "\n") << "    { \"scene\": \"random_scene\", \"grid\": " << r.grid << ", \"spheres\": " << r.spheres
+			<< ", \"width\": " << r.width << ", \"height\": " << r.height << ", \"spp\": " << r.samples_per_pixel
+			<< ", \"threads\": " << r.threads << ", \"scene_seconds\": " << r.scene_seconds << ", \"build_seconds\": " << r.build_seconds
+			<< ", \"scene_bytes_per_sphere\": " << r.scene_bytes_per_sphere << ", \"accel_bytes_per_sphere\": " << r.accel_bytes_per_sphere
+			<< ", \"render_seconds\": " << r.render_seconds
+			<< ", \"camera_rays\": " << r.camera_rays << ", \"camera_rays_per_second\": " << static_cast<double>(r.camera_rays) / r.render_seconds;
+		if (r.rays > 0)
+		{
+			out << ", \"rays\": " << r.rays << ", \"rays_per_second\": " << static_cast<double>(r.rays) / r.render_seconds;
+		}
+		out << " }";
+	}
+	out << (renders.empty() ? "]\n" : "\n  ]\n");
+	out << "}" << std::endl;
+}
+
+/// <summary>
+/// Parse a comma-separated list of integers
+/// </summary>
+bool parse_list(const char* text, std::vector<int>& out)
+{
+	out.clear();
+	std::stringstream in(text);
+	std::string item;
+	while (std::getline(in, item, ','))
+	{
+		int value = std::atoi(item.c_str());
+		if (value <= 0) return false;
+		out.push_back(value);
+	}
+	return !out.empty();
+}
+
+/// <summary>
+/// Parse the command line:
+/// --micro-only / --end-to-end-only  Run one half of the suite
+/// --min-time SECONDS  Time per microbenchmark repetition
+/// --repetitions N     Repetitions per microbenchmark, the median is reported
+/// --sizes N,N,...     Sphere counts of random_scene, e.g. 100,1000,10000,100000,1000000
+/// --resolutions WxH,...  Image sizes
+/// --spp N,N,...       Samples per pixel
+/// --repeats N         Renders per configuration, the fastest is reported
+/// --threads N         Worker threads (0 = all hardware threads)
+/// --output FILE       Write the JSON here instead of standard output
+/// </summary>
+bool parse_arguments(int argc, char* argv[], bench_options& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+
+		if (std::strcmp(argv[i], "--micro-only") == 0)
+		{
+			options.end_to_end = false;
+		}
+		else if (std::strcmp(argv[i], "--end-to-end-only") == 0)
+		{
+			options.micro = false;
+		}
+		else if (std::strcmp(argv[i], "--min-time") == 0 && has_value)
+		{
+			options.min_time = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--repetitions") == 0 && has_value)
+		{
+			options.repetitions = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--sizes") == 0 && has_value)
+		{
+			if (!parse_list(argv[++i], options.sizes)) return false;
+		}
+		else if (std::strcmp(argv[i], "--spp") == 0 && has_value)
+		{
+			if (!parse_list(argv[++i], options.spp)) return false;
+		}
+		else if (std::strcmp(argv[i], "--resolutions") == 0 && has_value)
+		{
+			options.resolutions.clear();
+			std::stringstream in(argv[++i]);
+			std::string item;
+			while (std::getline(in, item, ','))
+			{
+				int w = 0, h = 0;
+				if (std::sscanf(item.c_str(), "%dx%d", &w, &h) != 2 || w <= 1 || h <= 1)
+				{
+					std::cerr << "Bad resolution: " << item << std::endl;
+					return false;
+				}
+				options.resolutions.push_back({ w, h });
+			}
+		}
+		else if (std::strcmp(argv[i], "--repeats") == 0 && has_value)
+		{
+			options.render_repeats = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && has_value)
+		{
+			options.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && has_value)
+		{
+			options.output = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Run the benchmark suite and print its results as JSON. Progress goes to
+/// standard error so standard output stays machine-readable.
+/// </summary>
+int main(int argc, char* argv[])
+{
+	bench_options options;
+	if (!parse_arguments(argc, argv, options))
+	{
+		return 1;
+	}
+
+	std::vector<micro_result> micro;
+	if (options.micro) micro = run_micro_benchmarks(options);
+
+	std::vector<render_result> renders;
+	if (options.end_to_end) renders = run_end_to_end(options);
+
+	if (options.output.empty())
+	{
+		write_json(std::cout, micro, renders);
+		return 0;
+	}
+
+	std::ofstream file(options.output);
+	if (!file)
+	{
+		std::cerr << "Could not write " << options.output << std::endl;
+		return 1;
+	}
+
+	write_json(file, micro, renders);
+	return file ? 0 : 1;
+}
@@ -0,0 +1,621 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/// <summary>
+/// Node of a flattened BVH. Nodes are stored depth-first, so the first
+/// child of an interior node always follows it directly in the array.
+/// </summary>
+struct bvh_flat_node
+{
+	aabb box;
+	int offset; // Leaf: first primitive index. Interior: index of the second child
+	int count;  // Number of primitives in a leaf, 0 for interior nodes
+	int axis;   // Split axis of an interior node
+
+	bool is_leaf() const { return count > 0; }
+};
+
+/// <summary>
+/// Bounding volume hierarchy over an array of primitive bounding boxes.
+/// Built top-down with a binned surface area heuristic and traversed with
+/// an explicit stack. It only deals in primitive indices, so any primitive
+/// storage can put one on top of itself.
+/// </summary>
+class bvh_tree
+{
+public:
+	static const int bin_count = 16;
+	static const int max_depth = 60;
+
+	int max_leaf_size = 4;
+
+	std::vector<bvh_flat_node> nodes;
+	std::vector<int> indices; // Primitive order referenced by the leaves
+
+	bvh_tree() {}
+
+	/// <summary>
+	/// Build the tree
+	/// </summary>
+	/// <param name="boxes">Bounding box of every primitive</param>
+	/// <param name="leaf_size">Largest number of primitives in a leaf</param>
+	explicit bvh_tree(const std::vector<aabb>& boxes, int leaf_size = 4)
+	{
+		build(boxes, leaf_size);
+	}
+
+	void build(const std::vector<aabb>& boxes, int leaf_size = 4)
+	{
+		max_leaf_size = leaf_size > 0 ? leaf_size : 1;
+		nodes.clear();
+		indices.resize(boxes.size());
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			indices[i] = static_cast<int>(i);
+		}
+
+		if (boxes.empty()) return;
+
+		std::vector<point3> centroids(boxes.size());
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			centroids[i] = boxes[i].centroid();
+		}
+
+		nodes.reserve(2 * boxes.size());
+		build_recursive(boxes, centroids, 0, static_cast<int>(boxes.size()), 0);
+	}
+
+	bool empty() const { return nodes.empty(); }
+
+	/// <summary>
+	/// Recompute every node's box for primitives that moved, keeping the
+	/// tree's shape. Children are stored after their parent, so one
+	/// backwards sweep sees both children of a node before the node.
+	/// </summary>
+	/// <param name="box_of">box_of(k) gives the box of the primitive at position k of indices</param>
+	template <typename BoxOf>
+	void refit(BoxOf&& box_of)
+	{
+		for (size_t n = nodes.size(); n-- > 0;)
+		{
+			bvh_flat_node& node = nodes[n];
+			aabb box;
+
+			if (node.is_leaf())
+			{
+				for (int k = node.offset; k < node.offset + node.count; ++k)
+				{
+					box.expand(box_of(k));
+				}
+			}
+			else
+			{
+				box.expand(nodes[n + 1].box);
+				box.expand(nodes[node.offset].box);
+			}
+
+			node.box = box;
+		}
+	}
+
+	aabb bounds() const { return nodes.empty() ? aabb() : nodes[0].box; }
+
+	/// <summary>
+	/// Check the layout of nodes that were not built here, such as nodes
+	/// read from a file, so that traversal stays in bounds: children come
+	/// after their parent, leaves index existing primitives, split axes are
+	/// 0 to 2, and no node is deeper than the traversal stack allows.
+	/// </summary>
+	/// <param name="primitive_count">Number of primitives the leaves may refer to</param>
+	/// <returns>True if the tree can be traversed safely</returns>
+	bool valid(size_t primitive_count) const
+	{
+		if (nodes.size() > static_cast<size_t>(std::numeric_limits<int>::max())) return false;
+
+		const int node_count = static_cast<int>(nodes.size());
+		std::vector<int> depth(nodes.size(), 0);
+
+		for (int i = 0; i < node_count; ++i)
+		{
+			const bvh_flat_node& node = nodes[i];
+			if (node.count < 0 || depth[i] > max_depth) return false;
+
+			if (node.is_leaf())
+			{
+				if (node.offset < 0 || static_cast<size_t>(node.count) > primitive_count ||
+					static_cast<size_t>(node.offset) > primitive_count - static_cast<size_t>(node.count))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			if (node.axis < 0 || node.axis > 2 || node.offset <= i + 1 || node.offset >= node_count) return false;
+
+			depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+			depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Bytes of the node and index arrays
+	/// </summary>
+	size_t storage_bytes() const
+	{
+		return nodes.capacity() * sizeof(bvh_flat_node) + indices.capacity() * sizeof(int);
+	}
+
+	/// <summary>
+	/// Visit the leaves a ray may hit, nearer child first.
+	/// leaf_hit(first, count, t_max) tests the primitives indices[first .. first + count)
+	/// and returns the closest hit distance found below t_max, or a value >= t_max
+	/// if none was found. Farther subtrees are culled against the closest hit so far.
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <param name="leaf_hit">Primitive test for a leaf</param>
+	/// <returns>True if any primitive was hit</returns>
+	template <typename LeafHit>
+	bool traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const
+	{
+		if (nodes.empty()) return false;
+
+		const point3 origin = r.origin();
+		const vec3 dir = r.direction();
+		const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		const bool dir_negative[3] = { dir.x() < 0.0, dir.y() < 0.0, dir.z() < 0.0 };
+
+		int stack[max_depth + 4];
+		int stack_size = 0;
+		int current = 0;
+		bool hit_anything = false;
+
+		while (true)
+		{
+			const bvh_flat_node& node = nodes[current];
+			RT_STAT(thread_stats().box_tests++);
+
+			if (node.box.hit(origin, inv_dir, t_min, t_max))
+			{
+				if (node.is_leaf())
+				{
+					real t = leaf_hit(node.offset, node.count, t_max);
+					if (t < t_max)
+					{
+						t_max = t;
+						hit_anything = true;
+					}
+				}
+				else
+				{
+					// Descend into the child on the ray's side of the split first
+					int first = current + 1;
+					int second = node.offset;
+					if (dir_negative[node.axis]) std::swap(first, second);
+
+					stack[stack_size++] = second;
+					current = first;
+					continue;
+				}
+			}
+
+			if (stack_size == 0) break;
+			current = stack[--stack_size];
+		}
+
+		return hit_anything;
+	}
+
+	/// <summary>
+	/// Visit the leaves a ray may hit until one reports a hit. Unlike
+	/// traverse, the range never shrinks and the walk stops at the first
+	/// leaf where leaf_any(first, count) returns true.
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <param name="leaf_any">Primitive test for a leaf</param>
+	/// <returns>True if any primitive was hit</returns>
+	template <typename LeafAny>
+	bool any_hit(const ray& r, real t_min, real t_max, LeafAny&& leaf_any) const
+	{
+		if (nodes.empty()) return false;
+
+		const point3 origin = r.origin();
+		const vec3 dir = r.direction();
+		const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		const bool dir_negative[3] = { dir.x() < 0.0, dir.y() < 0.0, dir.z() < 0.0 };
+
+		int stack[max_depth + 4];
+		int stack_size = 0;
+		int current = 0;
+
+		while (true)
+		{
+			const bvh_flat_node& node = nodes[current];
+			RT_STAT(thread_stats().box_tests++);
+
+			if (node.box.hit(origin, inv_dir, t_min, t_max))
+			{
+				if (node.is_leaf())
+				{
+					if (leaf_any(node.offset, node.count)) return true;
+				}
+				else
+				{
+					// Nearer blockers are no better, but the near child is still the likelier one
+					int first = current + 1;
+					int second = node.offset;
+					if (dir_negative[node.axis]) std::swap(first, second);
+
+					stack[stack_size++] = second;
+					current = first;
+					continue;
+				}
+			}
+
+			if (stack_size == 0) break;
+			current = stack[--stack_size];
+		}
+
+		return false;
+	}
+
+private:
+	struct bin
+	{
+		aabb box;
+		int count = 0;
+	};
+
+	int build_recursive(const std::vector<aabb>& boxes, const std::vector<point3>& centroids, int begin, int end, int depth)
+	{
+		int node_index = static_cast<int>(nodes.size());
+		nodes.push_back(bvh_flat_node());
+
+		aabb box;
+		aabb centroid_box;
+		for (int i = begin; i < end; ++i)
+		{
+			box.expand(boxes[indices[i]]);
+			centroid_box.expand(centroids[indices[i]]);
+		}
+		nodes[node_index].box = box;
+
+		int count = end - begin;
+		int axis = 0;
+		int split_bin = -1;
+
+		if (count > max_leaf_size && depth < max_depth)
+		{
+			find_split(boxes, centroids, centroid_box, box, begin, end, axis, split_bin);
+		}
+
+		if (split_bin < 0)
+		{
+			make_leaf(node_index, begin, count);
+			return node_index;
+		}
+
+		// Partition primitives on the chosen bin boundary
+		double lo = centroid_box.minimum[axis];
+		double scale = bin_count / (centroid_box.maximum[axis] - lo);
+		auto mid_it = std::partition(indices.begin() + begin, indices.begin() + end, [&](int index) {
+			return bin_of(centroids[index][axis], lo, scale) <= split_bin;
+		});
+		int mid = static_cast<int>(mid_it - indices.begin());
+
+		if (mid == begin || mid == end)
+		{
+			make_leaf(node_index, begin, count);
+			return node_index;
+		}
+
+		build_recursive(boxes, centroids, begin, mid, depth + 1);
+		int second = build_recursive(boxes, centroids, mid, end, depth + 1);
+
+		nodes[node_index].offset = second;
+		nodes[node_index].count = 0;
+		nodes[node_index].axis = axis;
+
+		return node_index;
+	}
+
+	void make_leaf(int node_index, int begin, int count)
+	{
+		nodes[node_index].offset = begin;
+		nodes[node_index].count = count;
+		nodes[node_index].axis = 0;
+	}
+
+	// Clamped before the cast, which is undefined for NaN and out-of-range values
+	static int bin_of(double c, double lo, double scale)
+	{
+		double b = (c - lo) * scale;
+		if (!(b >= 0.0)) return 0;
+		return b >= bin_count ? bin_count - 1 : static_cast<int>(b);
+	}
+
+	/// <summary>
+	/// Pick the axis and bin boundary with the lowest SAH cost.
+	/// Leaves split_bin at -1 if keeping the node as a leaf is cheaper.
+	/// </summary>
+	void find_split(const std::vector<aabb>& boxes, const std::vector<point3>& centroids,
+		const aabb& centroid_box, const aabb& node_box, int begin, int end, int& best_axis, int& split_bin) const
+	{
+		const double traversal_cost = 1.0;
+		const double intersection_cost = 1.0;
+
+		int count = end - begin;
+		double best_cost = intersection_cost * count;
+		double inv_area = 1.0 / fmax(node_box.surface_area(), 1e-12);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			double lo = centroid_box.minimum[axis];
+			double extent = centroid_box.maximum[axis] - lo;
+			if (!(extent > 0.0)) continue;
+
+			double scale = bin_count / extent;
+
+			bin bins[bin_count];
+			for (int i = begin; i < end; ++i)
+			{
+				int index = indices[i];
+				bin& b = bins[bin_of(centroids[index][axis], lo, scale)];
+				b.box.expand(boxes[index]);
+				b.count++;
+			}
+
+			// Sweep from the right to get the cost of every right-hand side
+			double right_area[bin_count];
+			int right_count[bin_count];
+			aabb right_box;
+			int right_total = 0;
+			for (int b = bin_count - 1; b > 0; --b)
+			{
+				right_box.expand(bins[b].box);
+				right_total += bins[b].count;
+				right_area[b] = right_box.surface_area();
+				right_count[b] = right_total;
+			}
+
+			aabb left_box;
+			int left_total = 0;
+			for (int b = 0; b < bin_count - 1; ++b)
+			{
+				left_box.expand(bins[b].box);
+				left_total += bins[b].count;
+
+				if (left_total == 0 || right_count[b + 1] == 0) continue;
+
+				double cost = traversal_cost + intersection_cost * inv_area *
+					(left_box.surface_area() * left_total + right_area[b + 1] * right_count[b + 1]);
+
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					split_bin = b;
+				}
+			}
+		}
+
+		// Oversized leaves are worse than a slightly costlier split
+		if (split_bin < 0 && count > 4 * max_leaf_size)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (centroid_box.maximum[axis] - centroid_box.minimum[axis] > 0.0)
+				{
+					best_axis = axis;
+					split_bin = bin_count / 2 - 1;
+					break;
+				}
+			}
+		}
+	}
+};
+
+/// <summary>
+/// The frame an accelerator was last moved to. Geometry that many instances
+/// place is asked to move once per instance; it moves and refits on the
+/// first request of a frame and answers the rest from the stamp.
+/// </summary>
+struct frame_stamp
+{
+	bool set = false;
+	bool moved = false;
+	real time = 0.0;
+	real shutter = 0.0;
+
+	bool at(real frame_time, real frame_shutter) const
+	{
+		return set && frame_time == time && frame_shutter == shutter;
+	}
+
+	/// <returns>moved, to be returned from set_frame</returns>
+	bool mark(real frame_time, real frame_shutter, bool frame_moved)
+	{
+		set = true;
+		moved = frame_moved;
+		time = frame_time;
+		shutter = frame_shutter;
+		return moved;
+	}
+};
+
+/// <summary>
+/// BVH accelerator that can wrap any hittable_list. Replaces the linear scan
+/// of hittable_list::hit with a logarithmic walk over the objects' bounding boxes.
+/// Objects without finite bounds cannot be placed in the tree; they are kept
+/// aside and tested by every ray.
+/// </summary>
+class bvh_node : public hittable
+{
+public:
+	std::vector<shared_ptr<hittable>> objects;
+	std::vector<shared_ptr<hittable>> unbounded;
+	bvh_tree tree;
+	frame_stamp frame;
+
+	bvh_node() {}
+
+	/// <summary>
+	/// Build a BVH over every object of a list
+	/// </summary>
+	/// <param name="list">Objects to accelerate</param>
+	bvh_node(const hittable_list& list) : bvh_node(list.objects) {}
+
+	bvh_node(const std::vector<shared_ptr<hittable>>& src_objects)
+	{
+		std::vector<shared_ptr<hittable>> bounded;
+		std::vector<aabb> boxes;
+		bounded.reserve(src_objects.size());
+		boxes.reserve(src_objects.size());
+		for (const auto& object : src_objects)
+		{
+			aabb box;
+			if (object->bounding_box(box) && finite(box))
+			{
+				bounded.push_back(object);
+				boxes.push_back(box);
+			}
+			else
+			{
+				unbounded.push_back(object);
+			}
+		}
+
+		tree.build(boxes);
+
+		// Store the objects in leaf order so a leaf's objects sit next to each other
+		objects.reserve(bounded.size());
+		for (int index : tree.indices)
+		{
+			objects.push_back(bounded[index]);
+		}
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
+	virtual bool set_frame(real time, real shutter) override;
+	virtual size_t memory_bytes() const override;
+
+private:
+	static bool finite(const aabb& box)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (!std::isfinite(box.minimum[axis]) || !std::isfinite(box.maximum[axis])) return false;
+		}
+
+		return true;
+	}
+};
+
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+	bool hit_anything = tree.traverse(r, t_min, t_max, [&](int first, int count, real closest_so_far) {
+		for (int i = first; i < first + count; ++i)
+		{
+			if (objects[i]->hit(r, t_min, closest_so_far, rec))
+			{
+				closest_so_far = rec.t;
+			}
+		}
+
+		return closest_so_far;
+	});
+
+	for (const auto& object : unbounded)
+	{
+		if (object->hit(r, t_min, hit_anything ? rec.t : t_max, rec)) hit_anything = true;
+	}
+
+	return hit_anything;
+}
+
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const
+{
+	for (const auto& object : unbounded)
+	{
+		if (object->occluded(r, t_min, t_max)) return true;
+	}
+
+	return tree.any_hit(r, t_min, t_max, [&](int first, int count) {
+		for (int i = first; i < first + count; ++i)
+		{
+			if (objects[i]->occluded(r, t_min, t_max)) return true;
+		}
+
+		return false;
+	});
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const
+{
+	output_box = tree.bounds();
+	return !tree.empty() && unbounded.empty();
+}
+
+size_t bvh_node::memory_bytes() const
+{
+	size_t bytes = sizeof(*this) + tree.storage_bytes() + (objects.capacity() + unbounded.capacity()) * sizeof(objects[0]);
+	for (const auto& object : objects)
+	{
+		bytes += object->memory_bytes();
+	}
+	for (const auto& object : unbounded)
+	{
+		bytes += object->memory_bytes();
+	}
+
+	return bytes;
+}
+
+bool bvh_node::set_frame(real time, real shutter)
+{
+	if (frame.at(time, shutter)) return frame.moved;
+
+	bool moved = false;
+	for (const auto& object : unbounded)
+	{
+		moved = object->set_frame(time, shutter) || moved;
+	}
+
+	bool refit = false;
+	for (const auto& object : objects)
+	{
+		refit = object->set_frame(time, shutter) || refit;
+	}
+
+	if (refit)
+	{
+		tree.refit([&](int k) {
+			aabb box;
+			objects[k]->bounding_box(box);
+			return box;
+		});
+	}
+
+	return frame.mark(time, shutter, moved || refit);
+}
+
+#endif // !BVH_H
@@ -11,7 +11,8 @@ class camera
 		vec3 horizontal;
 		vec3 vertical;
 		vec3 u, v, w; // Orthonormal basis vectors
-		double lens_radius;
+		real lens_radius;
+		bool motion_blur = false; // Give rays a random time while the shutter is open
 
 		camera()
 		{
@@ -33,7 +34,7 @@ class camera
 		/// </summary>
 		/// <param name="fov">Vertical fov</param>
 		/// <param name="aspect_ratio">Aspect ratio</param>
-		camera(double fov, double aspect_ratio)
+		camera(real fov, real aspect_ratio)
 		{
 			auto theta = degrees_to_radians(fov);
 			auto h = tan(theta / 2.0f);
@@ -58,7 +59,7 @@ class camera
 		/// <param name="up">World up vector</param>
 		/// <param name="fov">vertical fov</param>
 		/// <param name="aspect">Aspect ratio</param>
-		camera(point3 lookfrom, point3 lookat, vec3 up, double fov, double aspect_ratio)
+		camera(point3 lookfrom, point3 lookat, vec3 up, real fov, real aspect_ratio)
 		{
 			auto theta = degrees_to_radians(fov);
 			auto h = tan(theta / 2.0f);
@@ -88,7 +89,7 @@ class camera
 		/// <param name="aspect">Aspect ratio</param>
 		/// <param name="aperture">Size of camera aperture</param>
 		/// <param name="focus_dist">Distance from camera at which everything is in focus</param>
-		camera(point3 lookfrom, point3 lookat, vec3 up, double fov, double aspect_ratio, double aperture, double focus_dist)
+		camera(point3 lookfrom, point3 lookat, vec3 up, real fov, real aspect_ratio, real aperture, real focus_dist)
 		{
 			auto theta = degrees_to_radians(fov);
 			auto h = tan(theta / 2.0f);
@@ -108,12 +109,13 @@ class camera
 			lens_radius = aperture / 2.0;
 		}
 
-		ray get_ray(double s, double t) const
+		ray get_ray(real s, real t, rng& gen) const
 		{
-			vec3 rd = lens_radius * random_in_unit_disk();
+			vec3 rd = lens_radius * random_in_unit_disk(gen);
 			vec3 offset = (u * rd.x()) + (v * rd.y());
+			real time = motion_blur ? static_cast<real>(random_double(gen)) : 0;
 
-			return ray(origin + offset, lower_left_corner + (s * horizontal) + (t * vertical) - origin - offset);
+			return ray(origin + offset, lower_left_corner + (s * horizontal) + (t * vertical) - origin - offset, time);
 		}
 };
 
@@ -0,0 +1,246 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+#include "mapped_file.h"
+#include "render_settings.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+/// <summary>
+/// Start of a checkpoint file. The file holds two slots of accumulation
+/// buffers; a save always fills the slot that is not active and only then
+/// flips active_slot, so a process killed mid-save leaves the previous
+/// checkpoint intact.
+/// </summary>
+struct checkpoint_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t max_depth;
+	uint32_t active_slot;
+	uint32_t reserved;
+	uint64_t saves;
+	uint64_t total_samples;
+	uint64_t scene_hash;    // Of the scene file, 0 for the built-in scene
+	uint64_t settings_hash; // Of the settings that decide the samples
+};
+
+/// <summary>
+/// Progressive accumulation buffers (sample sums, per-pixel sample counts,
+/// luminance sums and squared luminance sums) persisted in a memory-mapped file
+/// </summary>
+class checkpoint
+{
+public:
+	static constexpr const char* file_magic = "RTCKPT\0\0";
+	static const uint32_t file_version = 4;
+
+	/// <summary>
+	/// Hash a scene file's contents (FNV-1a), so a checkpoint is only
+	/// resumed for the scene it was saved from
+	/// </summary>
+	/// <param name="path">Scene file or cache, empty for the built-in scene</param>
+	/// <returns>Hash of the file, 0 for the built-in scene or a file that cannot be read</returns>
+	static uint64_t scene_hash(const std::string& path)
+	{
+		if (path.empty()) return 0;
+
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in) return 0;
+
+		uint64_t hash = fnv_basis;
+		char buffer[1 << 16];
+		while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+		{
+			hash = fnv(hash, buffer, static_cast<size_t>(in.gcount()));
+		}
+
+		return hash;
+	}
+
+	/// <summary>
+	/// Hash the settings that decide which samples a pixel gets and what
+	/// they add up to. The accelerator, integrator, tiles and passes do
+	/// not change the result and may differ between runs. The sample count
+	/// may grow to extend a render, except under the stratified sampler,
+	/// whose grid depends on it.
+	/// </summary>
+	static uint64_t settings_hash(const render_settings& settings)
+	{
+		int32_t grid = settings.sampler == sampler_kind::stratified ? settings.samples_per_pixel : 0;
+		const int32_t values[] = { grid, settings.max_depth, settings.roulette_depth, settings.min_samples,
+			static_cast<int32_t>(settings.sampler), static_cast<int32_t>(settings.light_sampling) };
+
+		uint64_t hash = fnv(fnv_basis, values, sizeof(values));
+		return fnv(hash, &settings.adaptive_threshold, sizeof(settings.adaptive_threshold));
+	}
+
+	/// <summary>
+	/// Open the checkpoint file for a render, or create it if it does not
+	/// exist. An existing file is checked before anything is written to it.
+	/// </summary>
+	/// <param name="path">Checkpoint file</param>
+	/// <param name="settings">Render settings, the image size and sampling settings must match to resume</param>
+	/// <param name="scene">scene_hash of the scene being rendered</param>
+	/// <returns>False if the file could not be opened, created or mapped</returns>
+	bool open(const std::string& path, const render_settings& settings, uint64_t scene)
+	{
+		width = static_cast<uint32_t>(settings.width);
+		height = static_cast<uint32_t>(settings.height);
+		max_depth = static_cast<uint32_t>(settings.max_depth);
+		scene_key = scene;
+		settings_key = settings_hash(settings);
+		resumable = false;
+		conflict.clear();
+
+		bool created = false;
+		if (!file.open(path, header_size() + 2 * slot_size(), created)) return false;
+		if (created)
+		{
+			// Mark the file as this render's before any samples go in
+			checkpoint_header& h = header();
+			std::memcpy(h.magic, file_magic, sizeof(h.magic));
+			h.version = file_version;
+			h.width = width;
+			h.height = height;
+			h.max_depth = max_depth;
+			h.scene_hash = scene_key;
+			h.settings_hash = settings_key;
+			return file.flush();
+		}
+
+		conflict = check();
+		if (!conflict.empty())
+		{
+			file.close();
+			return true;
+		}
+
+		// A file created by a run killed before its first save holds no
+		// samples yet and is simply reused
+		resumable = header().saves > 0;
+		return true;
+	}
+
+	/// <summary>
+	/// True if the file holds a saved render with the same settings
+	/// </summary>
+	bool can_resume() const { return resumable; }
+
+	/// <summary>
+	/// Why the existing file cannot be used for this render: it is not a
+	/// checkpoint, or it holds a render of another size, scene or with
+	/// other sampling settings. The file is left untouched and must not
+	/// be saved to. Empty if the file can be used.
+	/// </summary>
+	const std::string& conflicts() const { return conflict; }
+
+	/// <summary>
+	/// Copy the last saved buffers into a framebuffer
+	/// </summary>
+	/// <param name="image">Framebuffer of the checkpoint's size</param>
+	/// <returns>False if there is nothing to resume</returns>
+	bool load(framebuffer& image) const
+	{
+		if (!resumable) return false;
+
+		const unsigned char* slot = slot_data(header().active_slot);
+		std::memcpy(image.pixels.data(), slot, pixel_bytes());
+		std::memcpy(image.counts.data(), slot + pixel_bytes(), count_bytes());
+		std::memcpy(image.luminance_sum.data(), slot + pixel_bytes() + count_bytes(), luminance_bytes());
+		std::memcpy(image.luminance_sq.data(), slot + pixel_bytes() + count_bytes() + luminance_bytes(), luminance_bytes());
+		return true;
+	}
+
+	/// <summary>
+	/// Save the framebuffer into the inactive slot, flush it, then make it the active one
+	/// </summary>
+	/// <param name="image">Framebuffer to save</param>
+	/// <returns>False if the data could not be flushed to disk</returns>
+	bool save(const framebuffer& image)
+	{
+		checkpoint_header& h = header();
+		uint32_t target = resumable ? 1 - h.active_slot : 0;
+
+		unsigned char* slot = slot_data(target);
+		std::memcpy(slot, image.pixels.data(), pixel_bytes());
+		std::memcpy(slot + pixel_bytes(), image.counts.data(), count_bytes());
+		std::memcpy(slot + pixel_bytes() + count_bytes(), image.luminance_sum.data(), luminance_bytes());
+		std::memcpy(slot + pixel_bytes() + count_bytes() + luminance_bytes(), image.luminance_sq.data(), luminance_bytes());
+		if (!file.flush()) return false;
+
+		std::memcpy(h.magic, file_magic, sizeof(h.magic));
+		h.version = file_version;
+		h.width = width;
+		h.height = height;
+		h.max_depth = max_depth;
+		h.active_slot = target;
+		h.saves++;
+		h.total_samples = image.total_samples();
+		h.scene_hash = scene_key;
+		h.settings_hash = settings_key;
+		resumable = true;
+
+		return file.flush();
+	}
+
+private:
+	mapped_file file;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t max_depth = 0;
+	uint64_t scene_key = 0;
+	uint64_t settings_key = 0;
+	bool resumable = false;
+	std::string conflict;
+
+	static const uint64_t fnv_basis = 14695981039346656037ull;
+
+	static uint64_t fnv(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static size_t header_size() { return 64; }
+	size_t pixel_bytes() const { return static_cast<size_t>(width) * height * 3 * sizeof(float); }
+	size_t count_bytes() const { return static_cast<size_t>(width) * height * sizeof(uint32_t); }
+	size_t luminance_bytes() const { return static_cast<size_t>(width) * height * sizeof(double); }
+	size_t slot_size() const { return pixel_bytes() + count_bytes() + 2 * luminance_bytes(); }
+
+	checkpoint_header& header() { return *reinterpret_cast<checkpoint_header*>(file.data()); }
+	const checkpoint_header& header() const { return *reinterpret_cast<const checkpoint_header*>(file.data()); }
+
+	unsigned char* slot_data(uint32_t slot) { return file.data() + header_size() + slot * slot_size(); }
+	const unsigned char* slot_data(uint32_t slot) const { return file.data() + header_size() + slot * slot_size(); }
+
+	// Check an existing file against this render, empty if it matches
+	std::string check() const
+	{
+		if (file.length() < header_size()) return "is not a checkpoint";
+
+		const checkpoint_header& h = header();
+		if (std::memcmp(h.magic, file_magic, sizeof(h.magic)) != 0) return "is not a checkpoint";
+		if (h.version != file_version) return "was written by another version";
+		if (h.width != width || h.height != height) return "holds a render of another size";
+		if (file.length() != header_size() + 2 * slot_size() || h.active_slot >= 2) return "is damaged";
+		if (h.saves == 0) return std::string();
+		if (h.scene_hash != scene_key) return "holds a render of another scene";
+		if (h.max_depth != max_depth || h.settings_hash != settings_key) return "holds a render with other sampling settings";
+		return std::string();
+	}
+};
+
+static_assert(sizeof(checkpoint_header) <= 64, "checkpoint header must fit its reserved space");
+
+#endif // !CHECKPOINT_H
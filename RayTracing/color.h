@@ -3,23 +3,33 @@
 
 #include "vec3.h"
 
-#include <iostream>
+/// <summary>
+/// Convert an averaged linear color to gamma-corrected 8-bit RGB
+/// </summary>
+/// <param name="out">Destination for 3 bytes</param>
+/// <param name="pixel_color">Linear color</param>
+inline void write_color(unsigned char* out, color pixel_color) {
+    // Gamma-correct for gamma=2.0.
+    auto r = sqrt(pixel_color.x());
+    auto g = sqrt(pixel_color.y());
+    auto b = sqrt(pixel_color.z());
 
-void write_color(std::fstream& out, color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+    // Write the translated [0,255] value of each color component.
+    out[0] = static_cast<unsigned char>(256 * clamp(r, 0.0, 0.999));
+    out[1] = static_cast<unsigned char>(256 * clamp(g, 0.0, 0.999));
+    out[2] = static_cast<unsigned char>(256 * clamp(b, 0.0, 0.999));
+}
 
-    // Divide the color by the number of samples and gamma-correct for gamma=2.0.
+/// <summary>
+/// Convert a sum of samples to gamma-corrected 8-bit RGB
+/// </summary>
+/// <param name="out">Destination for 3 bytes</param>
+/// <param name="pixel_color">Sum of the pixel's samples</param>
+/// <param name="samples_per_pixel">Number of samples in the sum</param>
+inline void write_color(unsigned char* out, color pixel_color, int samples_per_pixel) {
+    // Divide the color by the number of samples.
     auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
-
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+    write_color(out, scale * pixel_color);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,207 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "aov.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/// <summary>
+/// Strength of the denoiser's edge-stopping functions. Smaller sigmas keep
+/// more edges and remove less noise.
+/// </summary>
+struct denoise_settings
+{
+	int iterations = 5;         // Passes of the 5x5 kernel, each twice as wide, 5 reach 124 pixels
+	float sigma_color = 3.0f;   // Luminance difference allowed, in standard deviations of the noise
+	float sigma_normal = 0.3f;  // Normal difference allowed
+	float sigma_depth = 0.05f;  // Depth difference allowed, relative to the depth
+	float sigma_albedo = 0.1f;  // Albedo difference allowed
+};
+
+namespace denoise_detail
+{
+	/// <summary>
+	/// exp(-x) for x >= 0 as (1 - x/16)^16, which falls off alike, is 0
+	/// from x = 16 on and vectorizes where std::exp does not
+	/// </summary>
+	inline float exp_neg(float x)
+	{
+		float t = std::max(0.0f, 1.0f - x * (1.0f / 16.0f));
+		t *= t;
+		t *= t;
+		t *= t;
+		t *= t;
+		return t;
+	}
+
+	inline float luma(float r, float g, float b) { return 0.2126f * r + 0.7152f * g + 0.0722f * b; }
+
+	const float albedo_floor = 1e-3f;
+}
+
+/// <summary>
+/// Edge-avoiding a-trous wavelet filter guided by the feature buffers and
+/// by the per-pixel noise estimate of the framebuffer.
+///
+/// The color is divided by the albedo first, so texture and material
+/// detail is not blurred, and multiplied back at the end. Every iteration
+/// applies the 5x5 B3-spline kernel with its taps 2^i pixels apart; a tap
+/// is weighted down by how much its normal, relative depth and albedo
+/// differ from the center and by its luminance difference relative to the
+/// center's noise. The noise variance is filtered along with the color so
+/// each pass adapts to what is left.
+///
+/// Images are kept as planes of floats and every kernel tap is applied to
+/// a whole row at once, so the inner loops are contiguous and vectorize;
+/// rows are spread over the thread pool.
+/// </summary>
+/// <param name="image">Rendered samples</param>
+/// <param name="aovs">Feature buffers of the same size</param>
+/// <param name="settings">Filter strength</param>
+/// <param name="pool">Worker threads</param>
+/// <returns>Denoised image, one sample per pixel</returns>
+inline framebuffer denoise(const framebuffer& image, const aov_buffers& aovs, const denoise_settings& settings, thread_pool& pool)
+{
+	using namespace denoise_detail;
+
+	const int width = image.width;
+	const int height = image.height;
+	const size_t n = static_cast<size_t>(width) * height;
+
+	// Planes: demodulated color, its luminance variance and the features
+	std::vector<float> r(n), g(n), b(n), variance(n);
+	std::vector<float> nx(n), ny(n), nz(n), depth(n), ar(n), ag(n), ab(n);
+
+	pool.parallel_for(height, [&](int j) {
+		for (int i = 0; i < width; ++i)
+		{
+			size_t k = image.index(i, j);
+			color c = image.average(i, j);
+
+			ar[k] = aovs.albedo[k * 3];
+			ag[k] = aovs.albedo[k * 3 + 1];
+			ab[k] = aovs.albedo[k * 3 + 2];
+			nx[k] = aovs.normal[k * 3];
+			ny[k] = aovs.normal[k * 3 + 1];
+			nz[k] = aovs.normal[k * 3 + 2];
+			depth[k] = aovs.depth[k];
+
+			r[k] = static_cast<float>(c.x()) / std::max(ar[k], albedo_floor);
+			g[k] = static_cast<float>(c.y()) / std::max(ag[k], albedo_floor);
+			b[k] = static_cast<float>(c.z()) / std::max(ab[k], albedo_floor);
+
+			// Pixels without a noise estimate count as fully uncertain
+			double v = image.mean_variance(i, j);
+			float mean = luma(r[k], g[k], b[k]);
+			float a = std::max(luma(ar[k], ag[k], ab[k]), albedo_floor);
+			variance[k] = std::isfinite(v) ? static_cast<float>(v) / (a * a) : mean * mean;
+		}
+	});
+
+	std::vector<float> out_r(n), out_g(n), out_b(n), out_variance(n);
+	std::vector<float> color_scale(n);
+
+	static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const float normal_scale = 1.0f / (settings.sigma_normal * settings.sigma_normal);
+	const float albedo_scale = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+
+	for (int iteration = 0; iteration < settings.iterations; ++iteration)
+	{
+		const int step = 1 << iteration;
+
+		// A variance from a few samples is itself noisy, so the edge-stopping
+		// function uses it blurred over the 3x3 neighborhood
+		pool.parallel_for(height, [&](int j) {
+			for (int i = 0; i < width; ++i)
+			{
+				float sum = 0.0f, sum_h = 0.0f;
+				for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); ++y)
+				{
+					for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); ++x)
+					{
+						float h = (y == j ? 0.5f : 0.25f) * (x == i ? 0.5f : 0.25f);
+						sum += h * variance[static_cast<size_t>(y) * width + x];
+						sum_h += h;
+					}
+				}
+				color_scale[static_cast<size_t>(j) * width + i] = 1.0f / (settings.sigma_color * std::sqrt(sum / sum_h) + 1e-4f);
+			}
+		});
+
+		pool.parallel_for(height, [&](int j) {
+			std::vector<float> sum_w(width, 0.0f), sum_r(width, 0.0f), sum_g(width, 0.0f), sum_b(width, 0.0f), sum_v(width, 0.0f);
+			const size_t row = static_cast<size_t>(j) * width;
+
+			for (int ky = -2; ky <= 2; ++ky)
+			{
+				int y = j + ky * step;
+				if (y < 0 || y >= height) continue;
+
+				for (int kx = -2; kx <= 2; ++kx)
+				{
+					const int dx = kx * step;
+					const int x0 = std::max(0, -dx);
+					const int x1 = std::min(width, width - dx);
+					const float h = kernel[ky + 2] * kernel[kx + 2];
+
+					// p: the pixel being filtered, q: the tap
+					const size_t p0 = row;
+					const size_t q0 = static_cast<size_t>(y) * width + dx;
+
+					for (int x = x0; x < x1; ++x)
+					{
+						const size_t p = p0 + x, q = q0 + x;
+
+						float d_luma = std::fabs(luma(r[p], g[p], b[p]) - luma(r[q], g[q], b[q]));
+						float d_nx = nx[p] - nx[q], d_ny = ny[p] - ny[q], d_nz = nz[p] - nz[q];
+						float d_ar = ar[p] - ar[q], d_ag = ag[p] - ag[q], d_ab = ab[p] - ab[q];
+						float d_depth = std::fabs(depth[p] - depth[q]) / (settings.sigma_depth * std::max(depth[p], depth[q]) + 1e-4f);
+
+						float w = h * exp_neg(d_luma * color_scale[p]
+							+ (d_nx * d_nx + d_ny * d_ny + d_nz * d_nz) * normal_scale
+							+ d_depth
+							+ (d_ar * d_ar + d_ag * d_ag + d_ab * d_ab) * albedo_scale);
+
+						sum_w[x] += w;
+						sum_r[x] += w * r[q];
+						sum_g[x] += w * g[q];
+						sum_b[x] += w * b[q];
+						sum_v[x] += w * w * variance[q];
+					}
+				}
+			}
+
+			// The center tap always has a weight, so sum_w is never zero
+			for (int x = 0; x < width; ++x)
+			{
+				float inv = 1.0f / sum_w[x];
+				out_r[row + x] = sum_r[x] * inv;
+				out_g[row + x] = sum_g[x] * inv;
+				out_b[row + x] = sum_b[x] * inv;
+				out_variance[row + x] = sum_v[x] * inv * inv;
+			}
+		});
+
+		r.swap(out_r);
+		g.swap(out_g);
+		b.swap(out_b);
+		variance.swap(out_variance);
+	}
+
+	framebuffer result(width, height);
+	for (size_t k = 0; k < n; ++k)
+	{
+		result.pixels[k * 3] = r[k] * std::max(ar[k], albedo_floor);
+		result.pixels[k * 3 + 1] = g[k] * std::max(ag[k], albedo_floor);
+		result.pixels[k * 3 + 2] = b[k] * std::max(ab[k], albedo_floor);
+		result.counts[k] = 1;
+	}
+
+	return result;
+}
+
+#endif // !DENOISE_H
@@ -0,0 +1,594 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "framebuffer.h"
+#include "render.h"
+#include "render_settings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Distributed rendering: a coordinator process hands work units, one pass
+// of one tile each, to worker processes over pipes and adds the partial
+// sums they send back into its framebuffer. Workers are started with the
+// coordinator's own command line plus --worker, so they load the same scene
+// with the same settings. Samples draw from generators keyed on pixel and
+// sample index, and a unit's sums are added exactly as render() would add
+// them, so the image is bit for bit that of a single-process render.
+
+namespace distributed_detail
+{
+	const uint32_t magic = 0x52544457; // "RTDW"
+
+	// Seconds a worker may take to load the scene and say hello
+	const double start_timeout = 300.0;
+
+	/// <summary>
+	/// Sent by a worker once its scene is ready
+	/// </summary>
+	struct hello
+	{
+		uint32_t magic;
+		int32_t width;
+		int32_t height;
+		int32_t tiles;
+	};
+
+	/// <summary>
+	/// Start of a work unit and of its result. A unit is followed by the
+	/// sample count and converged flag of every pixel of the tile, a result
+	/// by the sums, luminance sums, squared luminance sums (in double) and
+	/// new samples of every pixel,
+	/// all in row-major order within the tile. A negative tile stops the worker.
+	/// </summary>
+	struct unit_header
+	{
+		uint32_t magic;
+		int32_t tile;
+		int32_t pass;
+		int32_t pixels;
+	};
+
+	inline int tile_pixels(const tile& t) { return (t.x1 - t.x0) * (t.y1 - t.y0); }
+
+#ifndef _WIN32
+	inline bool write_all(int fd, const void* data, size_t size)
+	{
+		const char* p = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			ssize_t n = ::write(fd, p, size);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			size -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Read exactly size bytes
+	/// </summary>
+	/// <param name="timeout">Seconds to wait for the next byte before giving up, negative to wait forever</param>
+	/// <returns>False on end of file, an error or a stall</returns>
+	inline bool read_all(int fd, void* data, size_t size, double timeout = -1.0)
+	{
+		const int wait_ms = timeout < 0.0 ? -1 : static_cast<int>(std::min(timeout * 1000.0, 2147483647.0));
+
+		char* p = static_cast<char*>(data);
+		while (size > 0)
+		{
+			if (wait_ms >= 0)
+			{
+				pollfd ready = { fd, POLLIN, 0 };
+				int r = ::poll(&ready, 1, wait_ms);
+				if (r < 0 && errno == EINTR) continue;
+				if (r <= 0) return false;
+			}
+
+			ssize_t n = ::read(fd, p, size);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			size -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+#endif
+}
+
+/// <summary>
+/// Serve work units from a coordinator until it says stop. Each unit is
+/// rendered into a framebuffer that holds the coordinator's sample counts
+/// for the tile and zero sums, so what is sent back is exactly what the
+/// pass added.
+/// </summary>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings, the same as the coordinator's</param>
+/// <param name="in_fd">Pipe the units arrive on</param>
+/// <param name="out_fd">Pipe the results go to</param>
+/// <returns>False if the coordinator went away or sent something malformed</returns>
+inline bool run_worker(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings,
+	int in_fd, int out_fd)
+{
+#ifdef _WIN32
+	std::cerr << "Distributed rendering is not supported on Windows" << std::endl;
+	return false;
+#else
+	using namespace distributed_detail;
+
+	auto tiles = make_tiles(settings);
+	const packed_sphere_bvh* packed = packet_world(world, settings);
+	framebuffer image(settings.width, settings.height);
+
+	hello greeting = { magic, settings.width, settings.height, static_cast<int32_t>(tiles.size()) };
+	if (!write_all(out_fd, &greeting, sizeof(greeting))) return false;
+
+	std::vector<uint32_t> counts;
+	std::vector<uint8_t> converged;
+	std::vector<float> sums;
+	std::vector<double> luminance_sum, luminance_sq;
+	std::vector<uint32_t> added;
+
+	while (true)
+	{
+		unit_header unit;
+		if (!read_all(in_fd, &unit, sizeof(unit)) || unit.magic != magic) return false;
+		if (unit.tile < 0) return true;
+		if (unit.tile >= static_cast<int32_t>(tiles.size())) return false;
+
+		const tile& t = tiles[unit.tile];
+		const int n = tile_pixels(t);
+		if (unit.pixels != n) return false;
+
+		counts.resize(n);
+		converged.resize(n);
+		if (!read_all(in_fd, counts.data(), n * sizeof(uint32_t)) || !read_all(in_fd, converged.data(), n * sizeof(uint8_t))) return false;
+
+		int k = 0;
+		for (int j = t.y0; j < t.y1; ++j)
+		{
+			for (int i = t.x0; i < t.x1; ++i, ++k)
+			{
+				size_t p = image.index(i, j);
+				image.counts[p] = counts[k];
+				image.converged[p] = converged[k];
+				image.luminance_sum[p] = image.luminance_sq[p] = 0.0;
+				image.pixels[p * 3] = image.pixels[p * 3 + 1] = image.pixels[p * 3 + 2] = 0.0f;
+			}
+		}
+
+		render_tile_pass(t, world, packed, materials, lights, cam, settings, image);
+
+		sums.resize(static_cast<size_t>(n) * 3);
+		luminance_sum.resize(n);
+		luminance_sq.resize(n);
+		added.resize(n);
+
+		k = 0;
+		for (int j = t.y0; j < t.y1; ++j)
+		{
+			for (int i = t.x0; i < t.x1; ++i, ++k)
+			{
+				size_t p = image.index(i, j);
+				sums[k * 3] = image.pixels[p * 3];
+				sums[k * 3 + 1] = image.pixels[p * 3 + 1];
+				sums[k * 3 + 2] = image.pixels[p * 3 + 2];
+				luminance_sum[k] = image.luminance_sum[p];
+				luminance_sq[k] = image.luminance_sq[p];
+				added[k] = image.counts[p] - counts[k];
+			}
+		}
+
+		if (!write_all(out_fd, &unit, sizeof(unit)) ||
+			!write_all(out_fd, sums.data(), sums.size() * sizeof(float)) ||
+			!write_all(out_fd, luminance_sum.data(), luminance_sum.size() * sizeof(double)) ||
+			!write_all(out_fd, luminance_sq.data(), luminance_sq.size() * sizeof(double)) ||
+			!write_all(out_fd, added.data(), added.size() * sizeof(uint32_t)))
+		{
+			return false;
+		}
+	}
+#endif
+}
+
+/// <summary>
+/// Render the whole image progressively like render(), but with every tile
+/// of a pass traced by one of several worker processes. A worker that dies
+/// has its unit put back in the queue; once the queue is empty, a unit that
+/// has been out longer than unit_timeout is also given to an idle worker
+/// and whichever copy returns first is kept. With no worker idle, a worker
+/// whose unit is overdue is killed, as is one that stops sending for
+/// unit_timeout seconds in the middle of a result. Lost workers are
+/// restarted, at most as many times as there are workers.
+/// A pass is merged in full before the next one is planned, as adaptive
+/// sampling needs.
+/// </summary>
+/// <param name="command">Worker command line, the program first</param>
+/// <param name="worker_count">Worker processes to start</param>
+/// <param name="unit_timeout">Seconds before a unit is handed out again</param>
+/// <param name="settings">Render settings</param>
+/// <param name="image">Framebuffer receiving the sample sums</param>
+/// <param name="on_pass">Called after every pass, e.g. to checkpoint</param>
+/// <param name="on_tile">Called after every unit is merged, e.g. to preview its tile</param>
+/// <returns>False if no worker could finish the render, which is printed</returns>
+inline bool render_distributed(const std::vector<std::string>& command, int worker_count, double unit_timeout,
+	const render_settings& settings, framebuffer& image, const std::function<void(const framebuffer&)>& on_pass = nullptr,
+	const std::function<void(const tile&, const framebuffer&)>& on_tile = nullptr)
+{
+#ifdef _WIN32
+	std::cerr << "Distributed rendering is not supported on Windows" << std::endl;
+	return false;
+#else
+	using namespace distributed_detail;
+	using clock = std::chrono::steady_clock;
+
+	struct worker
+	{
+		pid_t pid = -1;
+		int to = -1;     // Units go here
+		int from = -1;   // Results come from here
+		int unit = -1;   // Tile being rendered, -1 when idle
+		bool alive = false;
+		clock::time_point sent; // When the unit was sent
+	};
+
+	struct unit_state
+	{
+		bool pending = false;  // Part of the current pass and not merged yet
+		clock::time_point handed_out;
+	};
+
+	// A worker writing to a coordinator that has given up on it must not kill it
+	std::signal(SIGPIPE, SIG_IGN);
+
+	auto tiles = make_tiles(settings);
+	std::vector<worker> workers(static_cast<size_t>(std::max(1, worker_count)));
+
+	std::vector<char*> args;
+	for (const auto& arg : command) args.push_back(const_cast<char*>(arg.c_str()));
+	args.push_back(nullptr);
+
+	auto stop = [](worker& w, bool kill_it) {
+		if (kill_it && w.pid > 0) ::kill(w.pid, SIGKILL);
+		if (w.to >= 0) ::close(w.to);
+		if (w.from >= 0) ::close(w.from);
+		if (w.pid > 0) ::waitpid(w.pid, nullptr, 0);
+		w = worker();
+	};
+
+	auto spawn = [&](worker& w) {
+		int to_child[2], from_child[2];
+		if (::pipe(to_child) != 0) return false;
+		if (::pipe(from_child) != 0)
+		{
+			::close(to_child[0]);
+			::close(to_child[1]);
+			return false;
+		}
+
+		// Keep later workers from inheriting this worker's pipes, or its
+		// end of file would never be seen
+		::fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+		::fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+
+		pid_t pid = ::fork();
+		if (pid == 0)
+		{
+			::dup2(to_child[0], 0);
+			::dup2(from_child[1], 1);
+			::close(to_child[0]);
+			::close(from_child[1]);
+#ifdef __linux__
+			::execv("/proc/self/exe", args.data());
+#endif
+			::execvp(args[0], args.data());
+			::_exit(127);
+		}
+
+		::close(to_child[0]);
+		::close(from_child[1]);
+		if (pid < 0)
+		{
+			::close(to_child[1]);
+			::close(from_child[0]);
+			return false;
+		}
+
+		w.pid = pid;
+		w.to = to_child[1];
+		w.from = from_child[0];
+		w.alive = true;
+		return true;
+	};
+
+	// Wait for a started worker's hello, stopping it if none comes in time
+	auto greet = [&](worker& w, double timeout) {
+		hello greeting;
+		if (!read_all(w.from, &greeting, sizeof(greeting), timeout) || greeting.magic != magic ||
+			greeting.width != settings.width || greeting.height != settings.height || greeting.tiles != static_cast<int32_t>(tiles.size()))
+		{
+			std::cerr << "Worker " << w.pid << " failed to start" << std::endl;
+			stop(w, true);
+			return false;
+		}
+		return true;
+	};
+
+	for (auto& w : workers)
+	{
+		if (!spawn(w)) break;
+	}
+
+	// Workers load the scene in parallel, then each says hello
+	int alive = 0;
+	auto start = clock::now();
+	for (auto& w : workers)
+	{
+		if (!w.alive) continue;
+
+		double left = std::max(0.0, start_timeout - std::chrono::duration<double>(clock::now() - start).count());
+		if (greet(w, left)) alive++;
+	}
+
+	// Lost workers are replaced, at most once per worker over the render
+	int restarts = static_cast<int>(workers.size());
+
+	std::vector<unit_state> units(tiles.size());
+	std::deque<int> queue;
+	std::vector<float> sums;
+	std::vector<double> luminance_sum, luminance_sq;
+	std::vector<uint32_t> counts, added;
+	std::vector<uint8_t> converged;
+	int pass = 0;
+	bool ok = alive > 0;
+
+	auto send_unit = [&](worker& w, int index) {
+		const tile& t = tiles[index];
+		const int n = tile_pixels(t);
+
+		counts.resize(n);
+		converged.resize(n);
+		int k = 0;
+		for (int j = t.y0; j < t.y1; ++j)
+		{
+			for (int i = t.x0; i < t.x1; ++i, ++k)
+			{
+				counts[k] = image.samples(i, j);
+				converged[k] = image.converged[image.index(i, j)];
+			}
+		}
+
+		unit_header unit = { magic, index, pass, n };
+		w.unit = index;
+		w.sent = units[index].handed_out = clock::now();
+
+		return write_all(w.to, &unit, sizeof(unit)) &&
+			write_all(w.to, counts.data(), n * sizeof(uint32_t)) &&
+			write_all(w.to, converged.data(), n * sizeof(uint8_t));
+	};
+
+	// Read a result, merging it if it is the first copy of a unit of this pass.
+	// Fails if the worker stalls partway, so one stuck worker cannot hang the render.
+	auto receive = [&](worker& w) {
+		unit_header unit;
+		if (!read_all(w.from, &unit, sizeof(unit), unit_timeout) || unit.magic != magic ||
+			unit.tile < 0 || unit.tile >= static_cast<int32_t>(tiles.size()))
+		{
+			return false;
+		}
+
+		const tile& t = tiles[unit.tile];
+		const int n = tile_pixels(t);
+		if (unit.pixels != n) return false;
+
+		sums.resize(static_cast<size_t>(n) * 3);
+		luminance_sum.resize(n);
+		luminance_sq.resize(n);
+		added.resize(n);
+		if (!read_all(w.from, sums.data(), sums.size() * sizeof(float), unit_timeout) ||
+			!read_all(w.from, luminance_sum.data(), luminance_sum.size() * sizeof(double), unit_timeout) ||
+			!read_all(w.from, luminance_sq.data(), luminance_sq.size() * sizeof(double), unit_timeout) ||
+			!read_all(w.from, added.data(), added.size() * sizeof(uint32_t), unit_timeout))
+		{
+			return false;
+		}
+
+		w.unit = -1;
+		if (unit.pass != pass || !units[unit.tile].pending) return true;
+
+		// The worker's sums started from zero, so adding them here rounds
+		// exactly as framebuffer::add does in a single-process render
+		int k = 0;
+		for (int j = t.y0; j < t.y1; ++j)
+		{
+			for (int i = t.x0; i < t.x1; ++i, ++k)
+			{
+				size_t p = image.index(i, j);
+				image.pixels[p * 3] += sums[k * 3];
+				image.pixels[p * 3 + 1] += sums[k * 3 + 1];
+				image.pixels[p * 3 + 2] += sums[k * 3 + 2];
+				image.luminance_sum[p] += luminance_sum[k];
+				image.luminance_sq[p] += luminance_sq[k];
+				image.counts[p] += added[k];
+			}
+		}
+
+		units[unit.tile].pending = false;
+		if (on_tile) on_tile(t, image);
+		return true;
+	};
+
+	// Kill a worker, put its unit back and start another in its place
+	// while restarts last
+	auto lose = [&](worker& w, const char* reason) {
+		std::cerr << "Lost worker " << w.pid << ": " << reason;
+		if (w.unit >= 0 && units[w.unit].pending) queue.push_front(w.unit);
+		stop(w, true);
+		alive--;
+
+		if (restarts <= 0)
+		{
+			std::cerr << std::endl;
+			return;
+		}
+
+		restarts--;
+		std::cerr << ", restarting it" << std::endl;
+		if (spawn(w) && greet(w, start_timeout)) alive++;
+	};
+
+	while (ok)
+	{
+		image.update_converged(settings);
+		if (!needs_samples(image, settings)) break;
+		pass++;
+
+		// Tiles whose pixels are all done make no unit
+		int remaining = 0;
+		for (const tile& t : tiles)
+		{
+			bool wanted = false;
+			for (int j = t.y0; j < t.y1 && !wanted; ++j)
+			{
+				for (int i = t.x0; i < t.x1 && !wanted; ++i)
+				{
+					wanted = pass_sample_count(image, i, j, settings) > 0;
+				}
+			}
+
+			units[t.index].pending = wanted;
+			if (wanted)
+			{
+				queue.push_back(t.index);
+				remaining++;
+			}
+		}
+
+		while (remaining > 0)
+		{
+			if (alive == 0)
+			{
+				std::cerr << "No workers left" << std::endl;
+				ok = false;
+				break;
+			}
+
+			// Hand out queued units, then copies of overdue ones
+			auto now = clock::now();
+			for (auto& w : workers)
+			{
+				if (!w.alive || w.unit >= 0) continue;
+
+				int index = -1;
+				while (!queue.empty() && index < 0)
+				{
+					if (units[queue.front()].pending) index = queue.front();
+					queue.pop_front();
+				}
+
+				if (index < 0)
+				{
+					for (size_t u = 0; u < units.size(); ++u)
+					{
+						if (units[u].pending && std::chrono::duration<double>(now - units[u].handed_out).count() > unit_timeout)
+						{
+							index = static_cast<int>(u);
+							break;
+						}
+					}
+				}
+
+				if (index < 0) break;
+				if (!send_unit(w, index)) lose(w, "it exited");
+			}
+
+			// Nobody is free to take a copy of an overdue unit, so stalled
+			// workers would never be noticed if they send nothing at all
+			bool idle = false;
+			for (const auto& w : workers) idle = idle || (w.alive && w.unit < 0);
+			for (auto& w : workers)
+			{
+				if (idle || !w.alive || w.unit < 0) continue;
+				if (std::chrono::duration<double>(now - w.sent).count() > unit_timeout) lose(w, "its unit is overdue");
+			}
+
+			std::vector<pollfd> fds;
+			std::vector<worker*> polled;
+			for (auto& w : workers)
+			{
+				if (!w.alive || w.unit < 0) continue;
+				fds.push_back({ w.from, POLLIN, 0 });
+				polled.push_back(&w);
+			}
+
+			if (fds.empty()) continue;
+
+			int ready = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), 100);
+			if (ready < 0 && errno != EINTR)
+			{
+				std::cerr << "Could not wait for workers" << std::endl;
+				ok = false;
+				break;
+			}
+
+			for (size_t f = 0; f < fds.size() && ready > 0; ++f)
+			{
+				if (fds[f].revents == 0) continue;
+
+				worker& w = *polled[f];
+				int index = w.unit;
+				bool was_pending = units[index].pending;
+
+				if (!receive(w))
+				{
+					lose(w, "it exited, stalled or sent a malformed result");
+				}
+				else if (was_pending && !units[index].pending)
+				{
+					remaining--;
+				}
+			}
+		}
+
+		if (ok && on_pass)
+		{
+			on_pass(image);
+		}
+	}
+
+	// Idle workers are told to stop, busy ones hold copies nobody needs
+	for (auto& w : workers)
+	{
+		if (!w.alive) continue;
+
+		unit_header quit = { magic, -1, 0, 0 };
+		bool busy = w.unit >= 0;
+		if (!busy) write_all(w.to, &quit, sizeof(quit));
+		stop(w, busy);
+	}
+
+	return ok;
+#endif
+}
+
+#endif // !DISTRIBUTED_H
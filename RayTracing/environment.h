@@ -0,0 +1,39 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+
+/// <summary>
+/// Sky seen by rays that escape the scene: a blend from one color straight
+/// down to another straight up, white to blue by default
+/// </summary>
+struct environment
+{
+	color nadir = color(1.0, 1.0, 1.0);
+	color zenith = color(0.5, 0.7, 1.0);
+
+	/// <summary>
+	/// Radiance arriving from a direction
+	/// </summary>
+	/// <param name="direction">Direction the light comes from, any length</param>
+	/// <returns>Radiance</returns>
+	color radiance(const vec3& direction) const
+	{
+		vec3 unit_dir = unit_vector(direction);
+		auto t = 0.5 * (unit_dir.y() + 1.0);
+
+		return (1.0 - t) * nadir + t * zenith;
+	}
+
+	/// <summary>
+	/// Color of the sky seen by an escaping ray
+	/// </summary>
+	color operator()(const ray& r) const { return radiance(r.direction()); }
+
+	/// <summary>
+	/// True if the sky gives no light
+	/// </summary>
+	bool black() const { return nadir.near_zero() && zenith.near_zero(); }
+};
+
+#endif // !ENVIRONMENT_H
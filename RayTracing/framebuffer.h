@@ -0,0 +1,247 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "render_settings.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/// <summary>
+/// Accumulated (unscaled) sample sums for every pixel, stored as packed
+/// 32-bit float RGB, plus the number of samples in each sum and the sums of
+/// the sample luminances and of their squares, from which the pixel's noise
+/// is estimated. The variance is the small difference of two large sums,
+/// so those two are kept in double. Passes keep adding to all of them, so
+/// a render can be resumed or extended at any time.
+/// Row 0 is the bottom of the image, matching the camera's v axis.
+/// </summary>
+class framebuffer
+{
+public:
+	int width;
+	int height;
+	std::vector<float> pixels;    // width * height RGB sums
+	std::vector<uint32_t> counts; // Samples in every sum
+	std::vector<double> luminance_sum; // Sum of the luminance of every sample
+	std::vector<double> luminance_sq; // Sum of the squared luminance of every sample
+	std::vector<uint8_t> converged; // Pixels adaptive sampling has stopped, see update_converged
+
+	framebuffer(int w, int h)
+		: width(w), height(h),
+		  pixels(static_cast<size_t>(w) * h * 3, 0.0f),
+		  counts(static_cast<size_t>(w) * h, 0),
+		  luminance_sum(static_cast<size_t>(w) * h, 0.0),
+		  luminance_sq(static_cast<size_t>(w) * h, 0.0),
+		  converged(static_cast<size_t>(w) * h, 0)
+	{}
+
+	size_t index(int i, int j) const { return static_cast<size_t>(j) * width + i; }
+
+	color get(int i, int j) const
+	{
+		const float* p = &pixels[index(i, j) * 3];
+		return color(p[0], p[1], p[2]);
+	}
+
+	uint32_t samples(int i, int j) const { return counts[index(i, j)]; }
+
+	/// <summary>
+	/// Add a batch of samples to a pixel
+	/// </summary>
+	/// <param name="i">Column</param>
+	/// <param name="j">Row</param>
+	/// <param name="sum">Sum of the new samples</param>
+	/// <param name="sum_sq">Sum of the squared luminance of the new samples</param>
+	/// <param name="n">Number of new samples</param>
+	void add(int i, int j, const color& sum, double sum_sq, uint32_t n)
+	{
+		size_t k = index(i, j);
+		float* p = &pixels[k * 3];
+		p[0] += static_cast<float>(sum.x());
+		p[1] += static_cast<float>(sum.y());
+		p[2] += static_cast<float>(sum.z());
+		counts[k] += n;
+		luminance_sum[k] += luminance(sum);
+		luminance_sq[k] += sum_sq;
+	}
+
+	/// <summary>
+	/// Average of the samples of a pixel
+	/// </summary>
+	color average(int i, int j) const
+	{
+		uint32_t n = samples(i, j);
+		return n > 0 ? get(i, j) / n : color(0.0, 0.0, 0.0);
+	}
+
+	/// <summary>
+	/// Estimated standard error of the pixel's displayed (gamma 2) luminance.
+	/// The sample variance gives the error of the linear mean, which the
+	/// slope of the square root scales to display values.
+	/// </summary>
+	/// <returns>Error in display units, 1/255 is one 8-bit step</returns>
+	double display_error(int i, int j) const
+	{
+		double n = counts[index(i, j)];
+		if (n < 2) return std::numeric_limits<double>::infinity();
+
+		double mean = luminance_sum[index(i, j)] / n;
+		double mean_error = std::sqrt(mean_variance(i, j));
+
+		return mean_error / (2.0 * std::sqrt(std::max(mean, 1e-4)));
+	}
+
+	/// <summary>
+	/// Estimated variance of the pixel's mean luminance, from the sample
+	/// variance of its luminances
+	/// </summary>
+	/// <returns>Variance, infinite with fewer than two samples</returns>
+	double mean_variance(int i, int j) const
+	{
+		size_t k = index(i, j);
+		double n = counts[k];
+		if (n < 2) return std::numeric_limits<double>::infinity();
+
+		double mean = luminance_sum[k] / n;
+		double variance = std::max(0.0, (luminance_sq[k] - mean * luminance_sum[k]) / (n - 1));
+		return variance / n;
+	}
+
+	/// <summary>
+	/// Mark the pixels adaptive sampling is done with: those holding at
+	/// least min_samples whose 3x3 neighbourhood is entirely below the error
+	/// threshold. Looking at the neighbours keeps a pixel whose few samples
+	/// happen to agree from stopping next to a noisy edge. Called between
+	/// passes, so tiles never read pixels another thread is writing.
+	/// </summary>
+	/// <param name="settings">Render settings</param>
+	void update_converged(const render_settings& settings)
+	{
+		if (settings.adaptive_threshold <= 0.0)
+		{
+			std::fill(converged.begin(), converged.end(), 0);
+			return;
+		}
+
+		std::vector<double> error(counts.size());
+		for (int j = 0; j < height; ++j)
+		{
+			for (int i = 0; i < width; ++i)
+			{
+				error[index(i, j)] = display_error(i, j);
+			}
+		}
+
+		for (int j = 0; j < height; ++j)
+		{
+			for (int i = 0; i < width; ++i)
+			{
+				double worst = 0.0;
+				for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); ++y)
+				{
+					for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); ++x)
+					{
+						worst = std::max(worst, error[index(x, y)]);
+					}
+				}
+
+				size_t k = index(i, j);
+				converged[k] = counts[k] >= static_cast<uint32_t>(settings.min_samples) && worst < settings.adaptive_threshold;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Fewest samples held by any pixel
+	/// </summary>
+	uint32_t min_samples() const
+	{
+		return counts.empty() ? 0 : *std::min_element(counts.begin(), counts.end());
+	}
+
+	/// <summary>
+	/// Most samples held by any pixel
+	/// </summary>
+	uint32_t max_samples() const
+	{
+		return counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+	}
+
+	/// <summary>
+	/// Samples held by all pixels together
+	/// </summary>
+	uint64_t total_samples() const
+	{
+		uint64_t total = 0;
+		for (uint32_t n : counts) total += n;
+		return total;
+	}
+
+	void clear()
+	{
+		std::fill(pixels.begin(), pixels.end(), 0.0f);
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(luminance_sum.begin(), luminance_sum.end(), 0.0);
+		std::fill(luminance_sq.begin(), luminance_sq.end(), 0.0);
+		std::fill(converged.begin(), converged.end(), 0);
+	}
+};
+
+/// <summary>
+/// Number of samples a pixel gets in the next pass. With adaptive sampling
+/// a pixel stops once update_converged has marked it; samples_per_pixel
+/// caps every pixel. With preview_samples the first passes are cheaper, so
+/// the whole image appears quickly before it is refined.
+/// </summary>
+/// <param name="image">Samples gathered so far</param>
+/// <param name="i">Column</param>
+/// <param name="j">Row</param>
+/// <param name="settings">Render settings</param>
+/// <returns>Samples to add, 0 once the pixel is done</returns>
+inline int pass_sample_count(const framebuffer& image, int i, int j, const render_settings& settings)
+{
+	int done = static_cast<int>(image.samples(i, j));
+	int remaining = std::max(0, settings.samples_per_pixel - done);
+	int count = settings.pass_samples > 0 ? std::min(settings.pass_samples, remaining) : remaining;
+
+	if (settings.preview_samples > 0 && (settings.pass_samples <= 0 || done < settings.pass_samples))
+	{
+		// Coarse passes first: preview_samples, then as many as are done
+		count = std::min(count, std::max(settings.preview_samples, done));
+	}
+
+	if (settings.adaptive_threshold > 0.0)
+	{
+		if (image.converged[image.index(i, j)]) return 0;
+
+		if (done < settings.min_samples)
+		{
+			// Stop at min_samples so the first error estimate is taken there
+			count = std::min(count, settings.min_samples - done);
+		}
+	}
+
+	return count;
+}
+
+/// <summary>
+/// True while any pixel still wants samples
+/// </summary>
+inline bool needs_samples(const framebuffer& image, const render_settings& settings)
+{
+	for (int j = 0; j < image.height; ++j)
+	{
+		for (int i = 0; i < image.width; ++i)
+		{
+			if (pass_sample_count(image, i, j, settings) > 0) return true;
+		}
+	}
+
+	return false;
+}
+
+#endif // !FRAMEBUFFER_H
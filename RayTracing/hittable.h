@@ -3,14 +3,22 @@
 
 #include "rtweekend.h"
 
-class material;
+#include "aabb.h"
+
+#include <cstdint>
+#include <type_traits>
+
+/// <summary>
+/// Index of a material in the scene's material_table
+/// </summary>
+using material_id = uint32_t;
 
 struct hit_record
 {
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat_ptr;
-	double t;
+	material_id mat_id;
+	real t;
 	bool front_face;
 
 	inline void set_face_normal(const ray& r, const vec3& outward_normal)
@@ -21,10 +29,53 @@ struct hit_record
 	}
 };
 
+// Hit records are copied for every closer hit, so they must stay plain data
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record must be trivially copyable");
+
 class hittable
 {
 public:
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+
+	/// <summary>
+	/// Check whether anything blocks a ray, for shadow and visibility rays.
+	/// Stops at the first intersection found instead of the nearest, and
+	/// computes no hit point, normal or material. The default falls back to hit.
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <returns>True if the ray hits something in (t_min, t_max)</returns>
+	virtual bool occluded(const ray& r, real t_min, real t_max) const
+	{
+		hit_record rec;
+		return hit(r, t_min, t_max, rec);
+	}
+
+	/// <summary>
+	/// Get a box enclosing the object, used to build acceleration structures
+	/// </summary>
+	/// <param name="output_box">Bounding box</param>
+	/// <returns>False if the object has no finite bounds</returns>
+	virtual bool bounding_box(aabb& output_box) const = 0;
+
+	/// <summary>
+	/// Move animated objects to a frame. A ray's time then runs from 0 at
+	/// the frame's shutter opening to 1 at its closing, and bounding boxes
+	/// enclose the whole motion. Acceleration structures refit their
+	/// bounds to the new positions.
+	/// </summary>
+	/// <param name="time">Time of the shutter opening in seconds</param>
+	/// <param name="shutter">Seconds the shutter stays open</param>
+	/// <returns>True if anything moved</returns>
+	virtual bool set_frame(real time, real shutter) { return false; }
+
+	/// <summary>
+	/// Bytes the object holds: its own size, the arrays it owns and the
+	/// objects it lists. An instance does not count the geometry it places,
+	/// which may be placed many times.
+	/// </summary>
+	virtual size_t memory_bytes() const = 0;
 };
 
 #endif
\ No newline at end of file
@@ -20,10 +20,14 @@ public:
 	void clear() { objects.clear(); }
 	void add(shared_ptr <hittable> object) { objects.push_back(object); }
 
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
+	virtual bool set_frame(real time, real shutter) override;
+	virtual size_t memory_bytes() const override;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
 	hit_record temp_rec;
 	bool hit_anything = false;
@@ -42,4 +46,52 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 	return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const
+{
+	for (const auto& object : objects)
+	{
+		if (object->occluded(r, t_min, t_max)) return true;
+	}
+
+	return false;
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const
+{
+	if (objects.empty()) return false;
+
+	aabb temp_box;
+	output_box = aabb();
+
+	for (const auto& object : objects)
+	{
+		if (!object->bounding_box(temp_box)) return false;
+		output_box.expand(temp_box);
+	}
+
+	return true;
+}
+
+bool hittable_list::set_frame(real time, real shutter)
+{
+	bool moved = false;
+	for (const auto& object : objects)
+	{
+		moved = object->set_frame(time, shutter) || moved;
+	}
+
+	return moved;
+}
+
+size_t hittable_list::memory_bytes() const
+{
+	size_t bytes = sizeof(*this) + objects.capacity() * sizeof(objects[0]);
+	for (const auto& object : objects)
+	{
+		bytes += object->memory_bytes();
+	}
+
+	return bytes;
+}
+
 #endif // !HITTABLE_LIST_H
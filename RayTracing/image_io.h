@@ -0,0 +1,333 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Output file formats
+/// </summary>
+enum class image_format
+{
+	ppm, // Binary P6, 8-bit gamma-corrected
+	png, // 8-bit gamma-corrected RGB
+	pfm  // Linear 32-bit float RGB (HDR)
+};
+
+/// <summary>
+/// Pick the format from a file name's extension, PPM if it is not recognized
+/// </summary>
+/// <param name="path">File name</param>
+/// <returns>Format</returns>
+inline image_format format_from_path(const std::string& path)
+{
+	auto dot = path.find_last_of('.');
+	std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+	for (auto& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+	if (ext == "png") return image_format::png;
+	if (ext == "pfm") return image_format::pfm;
+	return image_format::ppm;
+}
+
+/// <summary>
+/// Gamma-corrected 8-bit RGB rows, top row first
+/// </summary>
+/// <param name="image">Framebuffer</param>
+/// <param name="row_prefix">Bytes reserved before every row (PNG filter byte)</param>
+/// <returns>Packed rows</returns>
+inline std::vector<unsigned char> to_rgb8(const framebuffer& image, int row_prefix = 0)
+{
+	size_t stride = static_cast<size_t>(image.width) * 3 + row_prefix;
+	std::vector<unsigned char> rows(stride * image.height, 0);
+
+	for (int j = image.height - 1; j >= 0; --j)
+	{
+		unsigned char* out = &rows[stride * (image.height - 1 - j) + row_prefix];
+		for (int i = 0; i < image.width; ++i, out += 3)
+		{
+			write_color(out, image.average(i, j));
+		}
+	}
+
+	return rows;
+}
+
+/// <summary>
+/// Encode as binary PPM (P6)
+/// </summary>
+inline std::vector<unsigned char> encode_ppm(const framebuffer& image)
+{
+	std::string header = "P6\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n255\n";
+
+	std::vector<unsigned char> bytes(header.begin(), header.end());
+	auto rows = to_rgb8(image);
+	bytes.insert(bytes.end(), rows.begin(), rows.end());
+	return bytes;
+}
+
+/// <summary>
+/// Encode as little-endian PFM. PFM stores the bottom row first, like the framebuffer.
+/// </summary>
+inline std::vector<unsigned char> encode_pfm(const framebuffer& image)
+{
+	std::string header = "PF\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n-1.0\n";
+
+	std::vector<unsigned char> bytes(header.begin(), header.end());
+	size_t start = bytes.size();
+	bytes.resize(start + image.pixels.size() * sizeof(float));
+
+	std::vector<float> linear(image.pixels.size());
+	for (size_t k = 0; k < image.counts.size(); ++k)
+	{
+		float scale = image.counts[k] > 0 ? 1.0f / image.counts[k] : 0.0f;
+		linear[3 * k + 0] = image.pixels[3 * k + 0] * scale;
+		linear[3 * k + 1] = image.pixels[3 * k + 1] * scale;
+		linear[3 * k + 2] = image.pixels[3 * k + 2] * scale;
+	}
+
+	// Floats are written in host order, which is little-endian on every platform we build for
+	std::memcpy(&bytes[start], linear.data(), linear.size() * sizeof(float));
+	return bytes;
+}
+
+namespace png_detail
+{
+	inline uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0)
+	{
+		static const auto table = [] {
+			std::vector<uint32_t> t(256);
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < length; ++i)
+		{
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	inline void put_u32(std::vector<unsigned char>& out, uint32_t v)
+	{
+		out.push_back(static_cast<unsigned char>(v >> 24));
+		out.push_back(static_cast<unsigned char>(v >> 16));
+		out.push_back(static_cast<unsigned char>(v >> 8));
+		out.push_back(static_cast<unsigned char>(v));
+	}
+
+	inline void put_chunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+	{
+		put_u32(out, static_cast<uint32_t>(data.size()));
+
+		size_t type_start = out.size();
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data.begin(), data.end());
+
+		put_u32(out, crc32(&out[type_start], out.size() - type_start));
+	}
+
+	/// <summary>
+	/// Wrap raw bytes in a zlib stream made of stored (uncompressed) deflate blocks
+	/// </summary>
+	inline std::vector<unsigned char> zlib_store(const std::vector<unsigned char>& raw)
+	{
+		std::vector<unsigned char> out = { 0x78, 0x01 };
+		out.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+
+		size_t pos = 0;
+		do
+		{
+			size_t length = std::min<size_t>(65535, raw.size() - pos);
+			bool last = pos + length == raw.size();
+
+			out.push_back(last ? 1 : 0);
+			out.push_back(static_cast<unsigned char>(length));
+			out.push_back(static_cast<unsigned char>(length >> 8));
+			out.push_back(static_cast<unsigned char>(~length));
+			out.push_back(static_cast<unsigned char>(~length >> 8));
+			out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + length);
+
+			pos += length;
+		} while (pos < raw.size());
+
+		// Adler-32 of the uncompressed data
+		uint32_t a = 1, b = 0;
+		for (size_t i = 0; i < raw.size(); ++i)
+		{
+			a = (a + raw[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		put_u32(out, (b << 16) | a);
+
+		return out;
+	}
+}
+
+/// <summary>
+/// Encode as an 8-bit RGB PNG. The image data is stored without compression,
+/// which keeps encoding cheap and needs no zlib dependency.
+/// </summary>
+inline std::vector<unsigned char> encode_png(const framebuffer& image)
+{
+	std::vector<unsigned char> bytes = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	std::vector<unsigned char> header;
+	png_detail::put_u32(header, static_cast<uint32_t>(image.width));
+	png_detail::put_u32(header, static_cast<uint32_t>(image.height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8-bit, RGB, deflate, no filter, no interlace
+	png_detail::put_chunk(bytes, "IHDR", header);
+
+	// Every row starts with filter type 0 (none), which to_rgb8 leaves zeroed
+	png_detail::put_chunk(bytes, "IDAT", png_detail::zlib_store(to_rgb8(image, 1)));
+	png_detail::put_chunk(bytes, "IEND", {});
+
+	return bytes;
+}
+
+/// <summary>
+/// Encode a framebuffer in the given format
+/// </summary>
+inline std::vector<unsigned char> encode_image(const framebuffer& image, image_format format)
+{
+	switch (format)
+	{
+		case image_format::png: return encode_png(image);
+		case image_format::pfm: return encode_pfm(image);
+		default: return encode_ppm(image);
+	}
+}
+
+/// <summary>
+/// Encode a framebuffer and write it to a file, format chosen by extension
+/// </summary>
+/// <param name="image">Framebuffer</param>
+/// <param name="path">Output file</param>
+/// <returns>False if the file could not be written</returns>
+inline bool write_image(const framebuffer& image, const std::string& path)
+{
+	auto bytes = encode_image(image, format_from_path(path));
+
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	return static_cast<bool>(file);
+}
+
+/// <summary>
+/// Encodes and writes images on a background thread, so the render
+/// loop only pays for copying the framebuffer
+/// </summary>
+class async_image_writer
+{
+public:
+	async_image_writer() : worker([this] { run(); }) {}
+
+	~async_image_writer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		worker.join();
+	}
+
+	async_image_writer(const async_image_writer&) = delete;
+	async_image_writer& operator=(const async_image_writer&) = delete;
+
+	/// <summary>
+	/// Queue a snapshot of the framebuffer to be written
+	/// </summary>
+	/// <param name="image">Framebuffer to copy</param>
+	/// <param name="path">Output file, format chosen by extension</param>
+	void write(const framebuffer& image, const std::string& path)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back({ image, path });
+		}
+		changed.notify_all();
+	}
+
+	/// <summary>
+	/// Block until every queued image is on disk
+	/// </summary>
+	/// <returns>False if any write since the last wait failed</returns>
+	bool wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return jobs.empty() && !busy; });
+
+		bool ok = !failed;
+		failed = false;
+		return ok;
+	}
+
+private:
+	struct job
+	{
+		framebuffer image;
+		std::string path;
+	};
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<job> jobs;
+	bool busy = false;
+	bool failed = false;
+	bool stopping = false;
+	std::thread worker;
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true)
+		{
+			changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty()) return;
+
+			job next = std::move(jobs.front());
+			jobs.pop_front();
+			busy = true;
+
+			lock.unlock();
+			bool ok = write_image(next.image, next.path);
+			if (!ok)
+			{
+				std::fprintf(stderr, "Could not write %s\n", next.path.c_str());
+			}
+			lock.lock();
+
+			failed = failed || !ok;
+			busy = false;
+			changed.notify_all();
+		}
+	}
+};
+
+#endif // !IMAGE_IO_H
@@ -0,0 +1,84 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+/// <summary>
+/// A placement of shared geometry under an affine transform. Rays are moved
+/// into the geometry's object space for intersection and the hit is moved
+/// back, so any number of instances cost one transform each while the
+/// geometry, usually with its own BVH, is stored once. A BVH over instances
+/// then makes a two-level acceleration structure.
+/// </summary>
+class instance : public hittable
+{
+public:
+	shared_ptr<hittable> geometry;
+	affine_transform to_world;
+	affine_transform to_object;
+
+	instance() {}
+
+	/// <summary>
+	/// Place geometry in the world
+	/// </summary>
+	/// <param name="object">Shared geometry</param>
+	/// <param name="transform">Object-to-world transform</param>
+	instance(shared_ptr<hittable> object, const affine_transform& transform)
+		: geometry(object), to_world(transform), to_object(transform.inverse())
+	{
+		aabb object_box;
+		has_box = geometry->bounding_box(object_box);
+		if (has_box) world_box = to_world.apply_box(object_box);
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+	{
+		// The direction is not renormalized, so t means the same in both spaces
+		ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+
+		if (!geometry->hit(local, t_min, t_max, rec)) return false;
+
+		// Transforming the normal keeps its side relative to the ray, so front_face stays valid
+		rec.p = r.at(rec.t);
+		rec.normal = unit_vector(affine_transform::apply_normal(to_object, rec.normal));
+		return true;
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override
+	{
+		ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+		return geometry->occluded(local, t_min, t_max);
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = world_box;
+		return has_box;
+	}
+
+	virtual size_t memory_bytes() const override { return sizeof(*this); }
+
+	/// <summary>
+	/// Move the geometry and this placement's box to a frame. The geometry
+	/// is shared, it moves and refits on the first instance's request and
+	/// the others only transform its box again.
+	/// </summary>
+	virtual bool set_frame(real time, real shutter) override
+	{
+		if (!geometry->set_frame(time, shutter)) return false;
+
+		aabb object_box;
+		if (has_box && geometry->bounding_box(object_box)) world_box = to_world.apply_box(object_box);
+		return true;
+	}
+
+private:
+	aabb world_box;
+	bool has_box = false;
+};
+
+#endif // !INSTANCE_H
@@ -0,0 +1,360 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+
+#include "environment.h"
+#include "hittable.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/// <summary>
+/// An emissive sphere that paths aim at directly
+/// </summary>
+struct sphere_light
+{
+	point3 center;  // Center at time 0
+	vec3 velocity;  // Units per second
+	real radius;
+	color emit;
+};
+
+/// <summary>
+/// Direction toward a light picked for next-event estimation
+/// </summary>
+struct light_sample
+{
+	vec3 direction;    // Unit length
+	color radiance;    // Arriving from the light, unoccluded
+	real pdf = 0;      // Solid-angle density including the choice of light, 0 if nothing was sampled
+	real distance = 0; // To the light's surface, infinity for the sky
+};
+
+/// <summary>
+/// Power heuristic weight of a strategy with density a against one with density b
+/// </summary>
+inline real mis_weight(real a, real b)
+{
+	return a * a / (a * a + b * b);
+}
+
+/// <summary>
+/// Everything that gives light: the emissive spheres and the sky.
+///
+/// A light is picked in proportion to its emitted power, spheres by
+/// luminance times area and the sky, when there are spheres too, with
+/// probability one half. A sphere is sampled uniformly over the cone it
+/// subtends; the sky from a table of its luminance over latitude and
+/// longitude, so brighter parts get more samples.
+/// </summary>
+class light_list
+{
+public:
+	environment sky;
+	std::vector<sphere_light> spheres;
+
+	/// <summary>
+	/// Build the selection probabilities and the sky table. Called once the
+	/// lights are in; whatever is not sampled is only found by scattering.
+	/// </summary>
+	/// <param name="sample_spheres">Aim at the emissive spheres</param>
+	/// <param name="sample_sky">Aim at the sky</param>
+	void build(bool sample_spheres, bool sample_sky)
+	{
+		if (!sample_spheres) spheres.clear();
+
+		sky_probability = !sample_sky || sky.black() ? 0 : spheres.empty() ? 1 : 0.5;
+
+		sphere_cdf.assign(1, 0);
+		for (const auto& light : spheres)
+		{
+			double power = std::max(luminance(light.emit), 0.0) * light.radius * light.radius;
+			sphere_cdf.push_back(sphere_cdf.back() + power);
+		}
+
+		double total = sphere_cdf.back();
+		for (auto& c : sphere_cdf)
+		{
+			c = total > 0 ? c / total * (1 - sky_probability) : 0;
+		}
+
+		if (sky_probability > 0) build_sky_table();
+	}
+
+	/// <summary>
+	/// True if nothing can be sampled and paths only find light by chance
+	/// </summary>
+	bool empty() const { return sky_probability == 0 && spheres.empty(); }
+
+	/// <summary>
+	/// Move to a frame, as hittable::set_frame does for the spheres themselves
+	/// </summary>
+	void set_frame(real time, real shutter)
+	{
+		frame_time = time;
+		frame_shutter = shutter;
+	}
+
+	/// <summary>
+	/// Pick a light and a direction toward it
+	/// </summary>
+	/// <param name="p">Point being lit</param>
+	/// <param name="time">Time of the path</param>
+	/// <param name="gen">Random number generator for this path</param>
+	/// <returns>Sample, with a zero pdf if there is nothing to aim at</returns>
+	light_sample sample(const point3& p, real time, rng& gen) const
+	{
+		light_sample s;
+		double pick = random_double(gen);
+		double u = random_double(gen);
+		double v = random_double(gen);
+
+		if (pick < sky_probability)
+		{
+			s.direction = sample_sky(u, v, s.pdf);
+			s.pdf *= sky_probability;
+			s.radiance = sky.radiance(s.direction);
+			s.distance = infinity;
+			return s;
+		}
+
+		if (spheres.empty()) return s;
+
+		pick -= sky_probability;
+		size_t index = std::upper_bound(sphere_cdf.begin() + 1, sphere_cdf.end(), pick) - sphere_cdf.begin() - 1;
+		index = std::min(index, spheres.size() - 1);
+
+		const sphere_light& light = spheres[index];
+		vec3 to_center = center_at(light, time) - p;
+		real distance_squared = to_center.length_squared();
+		real radius_squared = light.radius * light.radius;
+		if (distance_squared <= radius_squared) return s;
+
+		// Uniform over the cone, with 1 - cos written so small lights keep their precision
+		real distance = std::sqrt(distance_squared);
+		real sin2_max = radius_squared / distance_squared;
+		real cos_max = std::sqrt(1 - sin2_max);
+		real one_minus_cos_max = sin2_max / (1 + cos_max);
+
+		real cos_theta = 1 - static_cast<real>(u) * one_minus_cos_max;
+		real sin_theta = std::sqrt(std::max<real>(0, 1 - cos_theta * cos_theta));
+		real phi = 2 * pi * static_cast<real>(v);
+
+		vec3 w = to_center / distance;
+		vec3 a = std::fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+		vec3 t = unit_vector(cross(a, w));
+		vec3 b = cross(w, t);
+
+		s.direction = unit_vector(std::cos(phi) * sin_theta * t + std::sin(phi) * sin_theta * b + cos_theta * w);
+		s.pdf = static_cast<real>(sphere_probability(index)) / (2 * pi * one_minus_cos_max);
+		s.radiance = light.emit;
+		s.distance = std::max<real>(0, distance * cos_theta - std::sqrt(std::max<real>(0, radius_squared - distance_squared * sin_theta * sin_theta)));
+		return s;
+	}
+
+	/// <summary>
+	/// Density with which sample() would have picked the direction from
+	/// origin to a point on an emissive sphere
+	/// </summary>
+	/// <param name="origin">Point that was lit</param>
+	/// <param name="hit">Point on the light</param>
+	/// <param name="time">Time of the path</param>
+	/// <returns>Solid-angle density, 0 if the point is on no sampled light</returns>
+	real sphere_pdf(const point3& origin, const point3& hit, real time) const
+	{
+		for (size_t index = 0; index < spheres.size(); ++index)
+		{
+			const sphere_light& light = spheres[index];
+			point3 center = center_at(light, time);
+			real radius = std::fabs(light.radius);
+			if (std::fabs((hit - center).length() - radius) > 1e-3 * radius) continue;
+
+			real distance_squared = (center - origin).length_squared();
+			real radius_squared = light.radius * light.radius;
+			if (distance_squared <= radius_squared) return 0;
+
+			real sin2_max = radius_squared / distance_squared;
+			real one_minus_cos_max = sin2_max / (1 + std::sqrt(1 - sin2_max));
+			return static_cast<real>(sphere_probability(index)) / (2 * pi * one_minus_cos_max);
+		}
+
+		return 0;
+	}
+
+	/// <summary>
+	/// Density with which sample() would have picked a direction toward the sky
+	/// </summary>
+	/// <param name="direction">Direction of an escaping ray</param>
+	/// <returns>Solid-angle density, 0 if the sky is not sampled</returns>
+	real sky_pdf(const vec3& direction) const
+	{
+		if (sky_probability == 0) return 0;
+
+		vec3 d = unit_vector(direction);
+		real cos_theta = std::clamp<real>(d.y(), -1, 1);
+		real sin_theta = std::sqrt(std::max<real>(0, 1 - cos_theta * cos_theta));
+		if (sin_theta <= 0) return 0;
+
+		real phi = std::atan2(d.z(), d.x());
+		if (phi < 0) phi += 2 * pi;
+
+		int x = std::min(sky_width - 1, static_cast<int>(phi / (2 * pi) * sky_width));
+		int y = std::min(sky_height - 1, static_cast<int>(std::acos(cos_theta) / pi * sky_height));
+
+		return static_cast<real>(sky_probability * sky_cells[static_cast<size_t>(y) * sky_width + x] / sky_integral / (2 * pi * pi * sin_theta));
+	}
+
+private:
+	// The sky table: luminance times sin(theta) per cell, theta from straight up
+	static const int sky_width = 64;
+	static const int sky_height = 32;
+
+	double sky_probability = 0;
+	std::vector<double> sphere_cdf;    // Cumulative selection probability, spheres.size() + 1 entries
+	std::vector<double> sky_cells;
+	std::vector<double> sky_rows;      // Cumulative distribution over rows, sky_height + 1 entries
+	std::vector<double> sky_columns;   // Cumulative distribution within each row, sky_width + 1 entries per row
+	double sky_integral = 0;           // Mean of the cells
+	real frame_time = 0;
+	real frame_shutter = 0;
+
+	point3 center_at(const sphere_light& light, real time) const
+	{
+		return light.center + (frame_time + frame_shutter * time) * light.velocity;
+	}
+
+	double sphere_probability(size_t index) const { return sphere_cdf[index + 1] - sphere_cdf[index]; }
+
+	static vec3 sky_direction(double u, double v)
+	{
+		double theta = v * pi, phi = u * 2 * pi;
+		return vec3(std::cos(phi) * std::sin(theta), std::cos(theta), std::sin(phi) * std::sin(theta));
+	}
+
+	void build_sky_table()
+	{
+		sky_cells.assign(static_cast<size_t>(sky_width) * sky_height, 0);
+		sky_rows.assign(sky_height + 1, 0);
+		sky_columns.assign(static_cast<size_t>(sky_width + 1) * sky_height, 0);
+
+		for (int y = 0; y < sky_height; ++y)
+		{
+			double* columns = &sky_columns[static_cast<size_t>(y) * (sky_width + 1)];
+			double sin_theta = std::sin((y + 0.5) / sky_height * pi);
+
+			for (int x = 0; x < sky_width; ++x)
+			{
+				double value = std::max(luminance(sky.radiance(sky_direction((x + 0.5) / sky_width, (y + 0.5) / sky_height))), 0.0) * sin_theta;
+				sky_cells[static_cast<size_t>(y) * sky_width + x] = value;
+				columns[x + 1] = columns[x] + value;
+			}
+
+			sky_rows[y + 1] = sky_rows[y] + columns[sky_width];
+			for (int x = 1; x <= sky_width; ++x)
+			{
+				columns[x] = columns[sky_width] > 0 ? columns[x] / columns[sky_width] : static_cast<double>(x) / sky_width;
+			}
+		}
+
+		sky_integral = sky_rows[sky_height] / (static_cast<double>(sky_width) * sky_height);
+		for (auto& r : sky_rows) r /= sky_rows[sky_height];
+	}
+
+	/// <summary>
+	/// Invert a cumulative distribution of n cells at u
+	/// </summary>
+	/// <returns>Position in [0, 1)</returns>
+	static double sample_cdf(const double* cdf, int n, double u)
+	{
+		int cell = static_cast<int>(std::upper_bound(cdf + 1, cdf + n + 1, u) - cdf) - 1;
+		cell = std::clamp(cell, 0, n - 1);
+
+		double width = cdf[cell + 1] - cdf[cell];
+		double offset = width > 0 ? (u - cdf[cell]) / width : 0.5;
+		return std::min((cell + std::clamp(offset, 0.0, 1.0)) / n, 0x1.fffffffffffffp-1);
+	}
+
+	vec3 sample_sky(double u, double v, real& pdf) const
+	{
+		double sv = sample_cdf(sky_rows.data(), sky_height, v);
+		int y = std::min(sky_height - 1, static_cast<int>(sv * sky_height));
+		double su = sample_cdf(&sky_columns[static_cast<size_t>(y) * (sky_width + 1)], sky_width, u);
+		int x = std::min(sky_width - 1, static_cast<int>(su * sky_width));
+
+		double sin_theta = std::sin(sv * pi);
+		pdf = sin_theta > 0 ? static_cast<real>(sky_cells[static_cast<size_t>(y) * sky_width + x] / sky_integral / (2 * pi * pi * sin_theta)) : 0;
+		return sky_direction(su, sv);
+	}
+};
+
+/// <summary>
+/// Next-event estimation at a diffuse surface: aim at a light, trace a
+/// shadow ray, and weigh what arrives against the chance that scattering
+/// would have found the same light (multiple importance sampling)
+/// </summary>
+/// <param name="lights">Lights of the scene</param>
+/// <param name="world">Hittable objects, for the shadow ray</param>
+/// <param name="rec">Diffuse surface point</param>
+/// <param name="albedo">Albedo of the surface</param>
+/// <param name="time">Time of the path</param>
+/// <param name="gen">Random number generator for this path</param>
+/// <returns>Light reflected toward the path, before its throughput</returns>
+inline color sample_direct_light(const light_list& lights, const hittable& world, const hit_record& rec, const color& albedo, real time, rng& gen)
+{
+	light_sample s = lights.sample(rec.p, time, gen);
+	if (!(s.pdf > 0)) return color(0.0, 0.0, 0.0);
+
+	real cos_theta = dot(rec.normal, s.direction);
+	if (cos_theta <= 0) return color(0.0, 0.0, 0.0);
+
+	ray shadow(rec.p, s.direction, time);
+	RT_STAT(thread_stats().shadow_rays++);
+	if (world.occluded(shadow, 0.001, s.distance * static_cast<real>(0.9999))) return color(0.0, 0.0, 0.0);
+
+	// Lambertian: BRDF albedo / pi, scattering density cos / pi
+	real scatter_pdf = cos_theta / pi;
+	return albedo * s.radiance * (scatter_pdf * mis_weight(s.pdf, scatter_pdf) / s.pdf);
+}
+
+/// <summary>
+/// Weight of light found by scattering into an emissive surface, against
+/// the chance that next-event estimation would have found it
+/// </summary>
+/// <param name="lights">Lights of the scene</param>
+/// <param name="scatter_pdf">Density of the scattered direction, 0 if the last bounce did not aim at lights</param>
+/// <param name="r">Scattered ray</param>
+/// <param name="rec">Where it hit the light</param>
+inline real emission_weight(const light_list& lights, real scatter_pdf, const ray& r, const hit_record& rec)
+{
+	if (scatter_pdf <= 0) return 1;
+
+	real light_pdf = lights.sphere_pdf(r.origin(), rec.p, r.time());
+	return light_pdf > 0 ? mis_weight(scatter_pdf, light_pdf) : 1;
+}
+
+/// <summary>
+/// Weight of sky light found by a scattered ray that escaped
+/// </summary>
+/// <param name="lights">Lights of the scene</param>
+/// <param name="scatter_pdf">Density of the scattered direction, 0 if the last bounce did not aim at lights</param>
+/// <param name="r">Escaping ray</param>
+inline real sky_weight(const light_list& lights, real scatter_pdf, const ray& r)
+{
+	if (scatter_pdf <= 0) return 1;
+
+	real light_pdf = lights.sky_pdf(r.direction());
+	return light_pdf > 0 ? mis_weight(scatter_pdf, light_pdf) : 1;
+}
+
+/// <summary>
+/// Density with which a diffuse surface scatters into a direction
+/// </summary>
+inline real lambertian_pdf(const hit_record& rec, const vec3& direction)
+{
+	return std::max<real>(0, dot(rec.normal, unit_vector(direction))) / pi;
+}
+
+#endif // !LIGHTS_H
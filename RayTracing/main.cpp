@@ -1,192 +1,615 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include "rtweekend.h"
 
-#include "color.h"
+#include "bvh.h"
+#include "checkpoint.h"
+#include "denoise.h"
+#include "distributed.h"
 #include "hittable_list.h"
+#include "image_io.h"
 #include "sphere.h"
 #include "camera.h"
 #include "material.h"
+#include "packed_spheres.h"
+#include "preview.h"
+#include "render.h"
+#include "random_scene.h"
+#include "scene_cache.h"
+#include "thread_pool.h"
 
 /// <summary>
-/// Recursively set the color of the ray given a world of hittable objects
+/// Command line options that are not render settings
 /// </summary>
-/// <param name="r">Ray</param>
-/// <param name="world">Hittable objects</param>
-/// <param name="depth">Maximum recursion depth</param>
-/// <returns>Color</returns>
-color ray_color(const ray& r, const hittable& world, int depth)
+struct program_options
 {
-	color col;
+	std::vector<std::string> outputs;
+	std::string checkpoint_path;
+	double checkpoint_interval = 60.0;
+	std::string scene_path;
+	std::string compile_path;
+	std::string stats_path;
+	int workers = 0;              // Worker processes, 0 renders in this process
+	double worker_timeout = 30.0; // Seconds before a unit is also given to another worker
+	bool worker = false;          // Serve work units on stdin and stdout
+	int frames = 1;
+	double fps = 24.0;
+	double shutter = 0.5;         // Fraction of a frame the shutter is open
+	bool denoise = false;
+	denoise_settings denoiser;
+	std::string aov_prefix;
+	std::string preview_target;   // Where tiles are streamed, empty for none
+	bool preview_samples_given = false;
+};
 
-	// Check if the ray hits the world
-	hit_record rec;
-
-	// Check if we've exceeded the ray bounce limit, no more light is gathered is we have
-	if (depth <= 0)
-	{
-		col = color(0.0, 0.0, 0.0);
-	}
-	else
+/// <summary>
+/// Read render options from the command line
+/// --scene FILE   Text scene or binary scene cache to render instead of the built-in scene
+/// --compile-scene FILE  Write the scene as a binary cache and exit
+/// --threads N    Worker threads (0 = all hardware threads)
+/// --tile-size N  Tile edge length in pixels
+/// --width N      Image width, the height follows from the aspect ratio
+/// --samples N    Samples per pixel, the most any pixel gets with adaptive sampling
+/// --min-samples N  Samples every pixel gets before adaptive sampling may stop it
+/// --adaptive-threshold E  Stop sampling a pixel once its display error is below E (0 = off)
+/// --max-depth N  Most bounces a path makes
+/// --roulette-depth N  Bounces before Russian roulette may end a path
+/// --accel NAME   World storage: list, bvh, packed or packed-bvh
+/// --integrator NAME  Path tracer: recursive or wavefront
+/// --sampler NAME  Sample pattern: independent, stratified, sobol, halton or blue-noise
+/// --light-sampling MODE  Shadow rays from diffuse surfaces: off, lights (emissive spheres) or all (the sky too)
+/// --output FILE  Image to write, .ppm, .png or .pfm (may be repeated)
+/// --pass-samples N  Samples per pixel added by each progressive pass (0 = all at once)
+/// --packet-size N  Camera rays traced together by the recursive integrator: 0, 4, 8 or 16
+/// --checkpoint FILE  Save the accumulation buffers here and resume from them
+/// --checkpoint-interval SECONDS  Minimum time between checkpoints
+/// --stats FILE   Write render counters as JSON (needs a build with RT_STATS)
+/// --workers N    Render with N worker processes started from this program (Linux)
+/// --worker-timeout SECONDS  Time after which a unit still out is also given to another worker
+/// --frames N     Render N frames of the scene's motion into numbered files (the default scene's small spheres move)
+/// --fps F        Frames per second of the sequence
+/// --shutter S    Fraction of a frame the shutter stays open, 0 turns off motion blur
+/// --denoise      Write the image through the feature-guided denoiser
+/// --denoise-iterations N  Passes of the denoising filter, each twice as wide as the last
+/// --aovs PREFIX  Write the albedo, normal and depth buffers to PREFIX_albedo.pfm, PREFIX_normal.pfm and PREFIX_depth.pfm
+/// --preview TARGET  Stream every finished tile to - (stdout), unix:PATH, tcp:PORT or a file or named pipe
+/// --preview-samples N  Samples of the coarse first pass, doubled every pass (0 = off, 1 with --preview)
+/// </summary>
+/// <param name="argc">Argument count</param>
+/// <param name="argv">Arguments</param>
+/// <param name="settings">Settings to update</param>
+/// <param name="options">Other options to update</param>
+/// <returns>False if an argument could not be parsed</returns>
+bool parse_arguments(int argc, char* argv[], render_settings& settings, program_options& options)
+{
+	for (int i = 1; i < argc; ++i)
 	{
-		// Check if ray hits target and prevent shadow acne
-		if (world.hit(r, 0.001, infinity, rec))
-		{
-			// Metal material
-			ray scattered;
-			color attenuation;
+		bool has_value = i + 1 < argc;
 
-			if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+		if (std::strcmp(argv[i], "--worker") == 0)
+		{
+			// Added by the coordinator when it starts a worker
+			options.worker = true;
+		}
+		else if (std::strcmp(argv[i], "--denoise") == 0)
+		{
+			options.denoise = true;
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && has_value)
+		{
+			settings.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--tile-size") == 0 && has_value)
+		{
+			settings.tile_size = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--width") == 0 && has_value)
+		{
+			settings.width = std::atoi(argv[++i]);
+			if (settings.width < 2)
 			{
-				col = attenuation * ray_color(scattered, world, depth - 1);
+				std::cerr << "Width must be at least 2" << std::endl;
+				return false;
 			}
+		}
+		else if (std::strcmp(argv[i], "--samples") == 0 && has_value)
+		{
+			settings.samples_per_pixel = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--min-samples") == 0 && has_value)
+		{
+			settings.min_samples = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--adaptive-threshold") == 0 && has_value)
+		{
+			settings.adaptive_threshold = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--max-depth") == 0 && has_value)
+		{
+			settings.max_depth = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--roulette-depth") == 0 && has_value)
+		{
+			settings.roulette_depth = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--accel") == 0 && has_value)
+		{
+			const char* name = argv[++i];
+
+			if (std::strcmp(name, "list") == 0) settings.accel = accelerator::list;
+			else if (std::strcmp(name, "bvh") == 0) settings.accel = accelerator::bvh;
+			else if (std::strcmp(name, "packed") == 0) settings.accel = accelerator::packed;
+			else if (std::strcmp(name, "packed-bvh") == 0) settings.accel = accelerator::packed_bvh;
 			else
 			{
-				col = color(0.0, 0.0, 0.0);
+				std::cerr << "Unknown accelerator: " << name << std::endl;
+				return false;
 			}
-
-			/*
-			// Lambertial Material
-			point3 target = rec.p + random_in_hemisphere(rec.normal); // Choose a random point on the sphere
-
-			col = 0.5 * ray_color(ray(rec.p, target - rec.p), world, depth - 1);
-			*/
 		}
-		else
+		else if (std::strcmp(argv[i], "--integrator") == 0 && has_value)
 		{
-			vec3 unit_dir = unit_vector(r.direction());
-			auto t = 0.5 * (unit_dir.y() + 1.0);
+			const char* name = argv[++i];
 
-			col = (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+			if (std::strcmp(name, "recursive") == 0) settings.method = integrator::recursive;
+			else if (std::strcmp(name, "wavefront") == 0) settings.method = integrator::wavefront;
+			else
+			{
+				std::cerr << "Unknown integrator: " << name << std::endl;
+				return false;
+			}
 		}
-	}
-
-	return col;
-}
-
-hittable_list random_scene()
-{
-	hittable_list world;
-
-	auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-	world.add(make_shared<sphere>(point3(0.0, -1000.0, 0.0), 1000.0, ground_material));
+		else if (std::strcmp(argv[i], "--sampler") == 0 && has_value)
+		{
+			const char* name = argv[++i];
 
-	for (int a = -11; a < 11; a++)
-	{
-		for (int b = -11; b < 11; b++)
+			if (std::strcmp(name, "independent") == 0) settings.sampler = sampler_kind::independent;
+			else if (std::strcmp(name, "stratified") == 0) settings.sampler = sampler_kind::stratified;
+			else if (std::strcmp(name, "sobol") == 0) settings.sampler = sampler_kind::sobol;
+			else if (std::strcmp(name, "halton") == 0) settings.sampler = sampler_kind::halton;
+			else if (std::strcmp(name, "blue-noise") == 0) settings.sampler = sampler_kind::blue_noise;
+			else
+			{
+				std::cerr << "Unknown sampler: " << name << std::endl;
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[i], "--light-sampling") == 0 && has_value)
 		{
-			auto choose_mat = random_double();
-			point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+			const char* name = argv[++i];
 
-			if ((center - point3(4.0, 0.2, 0.0)).length() > 0.9)
+			if (std::strcmp(name, "off") == 0) settings.light_sampling = light_sampling_mode::off;
+			else if (std::strcmp(name, "lights") == 0) settings.light_sampling = light_sampling_mode::lights;
+			else if (std::strcmp(name, "all") == 0) settings.light_sampling = light_sampling_mode::all;
+			else
+			{
+				std::cerr << "Unknown light sampling mode: " << name << std::endl;
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && has_value)
+		{
+			options.outputs.push_back(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--pass-samples") == 0 && has_value)
+		{
+			settings.pass_samples = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--packet-size") == 0 && has_value)
+		{
+			settings.packet_size = std::atoi(argv[++i]);
+			if (settings.packet_size != 0 && settings.packet_size != 4 && settings.packet_size != 8 && settings.packet_size != 16)
+			{
+				std::cerr << "Packet size must be 0, 4, 8 or 16" << std::endl;
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[i], "--checkpoint") == 0 && has_value)
+		{
+			options.checkpoint_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--checkpoint-interval") == 0 && has_value)
+		{
+			options.checkpoint_interval = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--scene") == 0 && has_value)
+		{
+			options.scene_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--compile-scene") == 0 && has_value)
+		{
+			options.compile_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0 && has_value)
+		{
+			options.stats_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--workers") == 0 && has_value)
+		{
+			options.workers = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--worker-timeout") == 0 && has_value)
+		{
+			options.worker_timeout = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0 && has_value)
+		{
+			options.frames = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--fps") == 0 && has_value)
+		{
+			options.fps = std::atof(argv[++i]);
+			if (!(options.fps > 0.0))
 			{
-				shared_ptr<material> sphere_material;
-
-				if (choose_mat < 0.8)
-				{
-					// Diffuse material
-					auto albedo = color::random() * color::random();
-					sphere_material = make_shared<lambertian>(albedo);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-				else if (choose_mat < 0.95)
-				{
-					// metal material
-					auto albedo = color::random(0.5, 1.0);
-					auto fuzz = random_double(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, fuzz);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-				else
-				{
-					// Glass material
-					sphere_material = make_shared<dielectric>(1.5);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
+				std::cerr << "Frames per second must be positive" << std::endl;
+				return false;
 			}
 		}
+		else if (std::strcmp(argv[i], "--shutter") == 0 && has_value)
+		{
+			options.shutter = std::atof(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--denoise-iterations") == 0 && has_value)
+		{
+			options.denoiser.iterations = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--aovs") == 0 && has_value)
+		{
+			options.aov_prefix = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--preview") == 0 && has_value)
+		{
+			options.preview_target = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--preview-samples") == 0 && has_value)
+		{
+			settings.preview_samples = std::max(0, std::atoi(argv[++i]));
+			options.preview_samples_given = true;
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+			return false;
+		}
 	}
 
-	auto material1 = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(0.0, 1.0, 0.0), 1.0, material1));
+	return true;
+}
+
+/// <summary>
+/// Output path of one frame of a sequence: the frame number goes before
+/// the extension, image.png becomes image_0007.png
+/// </summary>
+/// <param name="path">Path given on the command line</param>
+/// <param name="frame">Frame index</param>
+/// <param name="frames">Frames in the sequence, 1 keeps the path as it is</param>
+/// <returns>Path for the frame</returns>
+std::string frame_path(const std::string& path, int frame, int frames)
+{
+	if (frames <= 1) return path;
 
-	auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-	world.add(make_shared<sphere>(point3(-4.0, 1.0, 0.0), 1.0, material2));
+	char number[16];
+	std::snprintf(number, sizeof(number), "_%04d", frame);
 
-	auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<sphere>(point3(4.0, 1.0, 0.0), 1.0, material3));
+	auto dot = path.find_last_of('.');
+	auto slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + number;
 
-	return world;
+	return path.substr(0, dot) + number + path.substr(dot);
 }
 
 /// <summary>
 /// Write a ray traced scene into a .ppm file
 /// </summary>
 /// <returns></returns>
-int main()
+int main(int argc, char* argv[])
 {
-	std::fstream file("image.ppm");
-
 	// Image
-	const auto aspect = 3.0 / 2.0;
-	int width = 1200;
-	int height = static_cast<int>(width / aspect);
-	const int samples_per_pixel = 200;
-	const int max_depth = 50;
+	render_settings settings;
+	settings.width = 1200;
+	settings.samples_per_pixel = 200;
+	settings.max_depth = 50;
+
+	program_options options;
+	if (!parse_arguments(argc, argv, settings, options))
+	{
+		return 1;
+	}
+
+	// Tiles streamed to stdout must not be mixed with the log
+	if (options.preview_target == "-" && !options.worker)
+	{
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
+#ifndef RT_STATS
+	if (!options.stats_path.empty())
+	{
+		std::cerr << "--stats needs a build with RT_STATS, no counters will be written" << std::endl;
+	}
+#endif
 
 	// World
-	auto world = random_scene();
+	auto load_start = std::chrono::steady_clock::now();
+	scene world;
+	if (options.scene_path.empty())
+	{
+		default_scene(world, options.frames > 1);
+	}
+	else
+	{
+		if (!load_scene(options.scene_path, world, settings))
+		{
+			return 1;
+		}
+
+		// Settings given on the command line win over the scene's
+		options = program_options();
+		parse_arguments(argc, argv, settings, options);
+	}
+
+	if (!options.compile_path.empty())
+	{
+		return save_scene_cache(options.compile_path, world, settings) ? 0 : 1;
+	}
 
-	// Make materials for world
-	auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-	auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-	auto material_left = make_shared<dielectric>(1.5);
-	auto material_right = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
+	if (options.outputs.empty())
+	{
+		options.outputs.push_back("image.ppm");
+	}
 
-	// Add objects with materials to world
-	world.add(make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));
-	world.add(make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-	world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-	world.add(make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.45, material_left));
-	world.add(make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+	settings.height = static_cast<int>(settings.width / world.view.aspect);
 
-	// Camera
-	point3 lookfrom(13.0, 2.0, 3.0);
-	point3 lookat(0.0, 0.0, 0.0);
-	vec3 up(0.0, 1.0, 0.0);
-	auto dist_to_focus = 10.0;
-	auto aperture = 0.1;
+	// Pixel centers are spread over (size - 1), and a scene may set the width
+	if (settings.width < 2 || settings.height < 2)
+	{
+		std::cerr << "Image of " << settings.width << "x" << settings.height << " is too small, width and height must be at least 2" << std::endl;
+		return 1;
+	}
 
-	camera cam(lookfrom, lookat, up, 20.0, aspect, aperture, dist_to_focus);
+	// A preview starts coarse; workers see the same arguments, so they agree
+	if (!options.preview_target.empty() && !options.preview_samples_given)
+	{
+		settings.preview_samples = 1;
+	}
 
-	// Render
-	file << "P3" << std::endl << width << " " << height << "\n255" << std::endl;
+	int width = settings.width;
+	int height = settings.height;
+
+	camera cam = world.view.make_camera();
+
+	auto accel = build_accelerator(world, settings.accel);
+	light_list lights = make_lights(world, settings.light_sampling);
+
+	// Frame 0, so that moving objects have their boxes over its shutter
+	double shutter = options.shutter / options.fps;
+	cam.motion_blur = accel->set_frame(0.0, shutter) && shutter > 0.0;
+	lights.set_frame(0.0, shutter);
+	std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+
+	// A worker's stdout carries its results, so it prints nothing
+	if (options.worker)
+	{
+		return run_worker(*accel, world.materials, lights, cam, settings, 0, 1) ? 0 : 1;
+	}
 
-	for (int j = height - 1; j >= 0; --j)
+	if (options.frames > 1 && (options.workers > 0 || !options.checkpoint_path.empty()))
 	{
-		for (int i = 0; i < width; ++i)
+		std::cerr << "--frames cannot be combined with --workers or --checkpoint" << std::endl;
+		return 1;
+	}
+
+	std::cout << "Scene ready in " << load_time.count() << "s" << std::endl;
+
+	size_t primitives = primitive_count(world);
+	if (primitives > 0)
+	{
+		size_t scene_bytes = scene_storage_bytes(world);
+		size_t accel_bytes = accelerator_bytes(*accel, world);
+		std::cout << primitives << " primitives: scene storage " << scene_bytes << " bytes (" << static_cast<double>(scene_bytes) / primitives
+			<< " per primitive), accelerator " << accel_bytes << " bytes (" << static_cast<double>(accel_bytes) / primitives << " per primitive)" << std::endl;
+	}
+	RT_STAT(stats_registry::instance().add_phase("load", load_time.count()));
+
+	tile_stream preview;
+	if (!options.preview_target.empty() && !preview.open(options.preview_target))
+	{
+		return 1;
+	}
+
+	// Render. The pool, the scene and the buffers are kept for every frame
+	thread_pool pool(settings.threads);
+	framebuffer image(width, height);
+	framebuffer denoised(0, 0);
+	async_image_writer writer;
+	RT_STAT(double write_time = 0.0);
+
+	// Pick up the samples of an earlier run of the same image
+	checkpoint saved;
+	if (!options.checkpoint_path.empty())
+	{
+		if (!saved.open(options.checkpoint_path, settings, checkpoint::scene_hash(options.scene_path)))
 		{
-			color pixel_color(0.0, 0.0, 0.0);
+			std::cerr << "Could not open checkpoint " << options.checkpoint_path << std::endl;
+			return 1;
+		}
+
+		if (!saved.conflicts().empty())
+		{
+			std::cerr << "Checkpoint " << options.checkpoint_path << " " << saved.conflicts()
+				<< ", remove it or choose another file" << std::endl;
+			return 1;
+		}
+
+		if (saved.load(image))
+		{
+			std::cout << "Resuming from " << options.checkpoint_path << " at " << image.min_samples() << " samples per pixel" << std::endl;
+		}
+	}
+
+	for (int frame = 0; frame < options.frames; ++frame)
+	{
+		if (frame > 0)
+		{
+			// Positions change, the BVH is refit rather than rebuilt
+			auto refit_start = std::chrono::steady_clock::now();
+			accel->set_frame(frame / options.fps, shutter);
+			lights.set_frame(frame / options.fps, shutter);
+			image.clear();
+
+			std::chrono::duration<double> refit_time = std::chrono::steady_clock::now() - refit_start;
+			std::cout << "Frame " << frame << " ready in " << refit_time.count() << "s" << std::endl;
+			RT_STAT(stats_registry::instance().add_phase("refit", refit_time.count()));
+		}
+
+		uint64_t resumed_samples = image.total_samples();
+
+		auto start = std::chrono::steady_clock::now();
+		auto last_save = start;
 
-			// Antialiase image
-			for (int s = 0; s < samples_per_pixel; ++s)
+		std::function<void(const tile&, const framebuffer&)> on_tile;
+		if (preview.is_open())
+		{
+			preview.begin_frame(frame, width, height);
+			on_tile = [&](const tile& t, const framebuffer& progress) { preview.send_tile(t, progress); };
+		}
+
+		auto on_pass = [&](const framebuffer& progress) {
+			if (options.checkpoint_path.empty()) return;
+
+			auto now = std::chrono::steady_clock::now();
+			if (std::chrono::duration<double>(now - last_save).count() < options.checkpoint_interval) return;
+
+			if (!saved.save(progress))
+			{
+				std::cerr << "Could not save checkpoint " << options.checkpoint_path << std::endl;
+			}
+			last_save = now;
+		};
+
+		if (options.workers > 0)
+		{
+			std::vector<std::string> command(argv, argv + argc);
+			command.push_back("--worker");
+
+			if (!render_distributed(command, options.workers, options.worker_timeout, settings, image, on_pass, on_tile))
+			{
+				return 1;
+			}
+		}
+		else
+		{
+			render(*accel, world.materials, lights, cam, settings, pool, image, on_pass, on_tile);
+		}
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		RT_STAT(stats_registry::instance().add_phase("render", elapsed.count()));
+
+		if (!options.checkpoint_path.empty() && !saved.save(image))
+		{
+			std::cerr << "Could not save checkpoint " << options.checkpoint_path << std::endl;
+		}
+
+		double samples = static_cast<double>(image.total_samples() - resumed_samples);
+		std::string ran_on = options.workers > 0 ? std::to_string(options.workers) + " worker processes" : std::to_string(pool.size()) + " threads";
+		std::cout << "Rendered " << width << "x" << height << " in " << elapsed.count()
+			<< "s on " << ran_on << " (" << samples / elapsed.count() / 1e6
+			<< " Msamples/s)" << std::endl;
+
+		std::cout << "Spent " << image.total_samples() << " samples, " << static_cast<double>(image.total_samples()) / (static_cast<double>(width) * height)
+			<< " per pixel on average (" << image.min_samples() << " to " << image.max_samples() << ")" << std::endl;
+
+		// The previous frame's files were written while this one rendered
+		RT_STAT(auto write_start = std::chrono::steady_clock::now());
+		if (!writer.wait())
+		{
+			return 1;
+		}
+		RT_STAT(write_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count());
+
+		// Feature buffers and denoising
+		const framebuffer* result = &image;
+
+		if (options.denoise || !options.aov_prefix.empty())
+		{
+			auto denoise_start = std::chrono::steady_clock::now();
+
+			aov_buffers aovs(width, height);
+			render_aovs(*accel, world.materials, lights, cam, settings, pool, aovs);
+
+			if (options.denoise)
 			{
-				// Send rays through each sample of a pixel and then average them for the pixel
-	
-				auto u = (i + random_double()) / (width - 1);
-				auto v = (j + random_double()) / (height - 1);
+				denoised = denoise(image, aovs, options.denoiser, pool);
+				result = &denoised;
+			}
+
+			std::chrono::duration<double> denoise_time = std::chrono::steady_clock::now() - denoise_start;
+			std::cout << (options.denoise ? "Denoised in " : "Feature buffers in ") << denoise_time.count() << "s" << std::endl;
+			RT_STAT(stats_registry::instance().add_phase("denoise", denoise_time.count()));
 
-				ray r = cam.get_ray(u, v); // Shoot ray
-				pixel_color += ray_color(r, world, max_depth); // Find color of pixel
+			if (!options.aov_prefix.empty())
+			{
+				std::string prefix = frame_path(options.aov_prefix, frame, options.frames);
+				writer.write(to_framebuffer(width, height, aovs.albedo, 3), prefix + "_albedo.pfm");
+				writer.write(to_framebuffer(width, height, aovs.normal, 3), prefix + "_normal.pfm");
+				writer.write(to_framebuffer(width, height, aovs.depth, 1), prefix + "_depth.pfm");
+			}
+		}
+
+		if (preview.is_open())
+		{
+			// The viewer ends up with the image as written
+			if (result != &image)
+			{
+				for (const tile& t : make_tiles(settings)) preview.send_tile(t, *result);
 			}
+			preview.end_frame(frame);
 
-			write_color(file, pixel_color, samples_per_pixel); // Write color into file
+			std::cout << "First preview tile after " << preview.time_to_first_tile() << "s" << std::endl;
 		}
+
+		// Encoding and disk I/O happen on the writer's thread
+		for (const auto& output : options.outputs)
+		{
+			writer.write(*result, frame_path(output, frame, options.frames));
+		}
+	}
+
+	RT_STAT(auto write_start = std::chrono::steady_clock::now());
+	if (!writer.wait())
+	{
+		return 1;
 	}
 
-	file.close();
+#ifdef RT_STATS
+	write_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+	stats_registry::instance().add_phase("write", write_time);
+
+	render_stats totals = stats_registry::instance().total();
+	double rays = static_cast<double>(totals.total_rays());
+	std::cout << "Traced " << totals.total_rays() << " rays, " << rays / std::max<double>(1.0, static_cast<double>(totals.total_paths()))
+		<< " per path, " << static_cast<double>(totals.sphere_tests + totals.triangle_tests + totals.box_tests) / std::max(1.0, rays)
+		<< " intersection tests per ray" << std::endl;
+
+	if (!options.stats_path.empty())
+	{
+		std::ofstream stats_file(options.stats_path);
+		write_stats_json(stats_file, totals, stats_registry::instance().phase_times(), image.counts);
+		if (!stats_file)
+		{
+			std::cerr << "Could not write " << options.stats_path << std::endl;
+			return 1;
+		}
+	}
+#endif
 
 	std::cout << "End" << std::endl;
 
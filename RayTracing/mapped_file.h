@@ -0,0 +1,231 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// A file mapped into memory for reading and writing
+/// </summary>
+class mapped_file
+{
+public:
+	mapped_file() {}
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	/// <summary>
+	/// Map a file for reading and writing. An existing file is mapped at its
+	/// current size and never resized, so the caller can check what it holds
+	/// before writing; a missing file is created with the given size.
+	/// </summary>
+	/// <param name="path">File to map</param>
+	/// <param name="length">Size of the file if it has to be created</param>
+	/// <param name="created">Set if the file did not exist and was created</param>
+	/// <returns>False if the file could not be opened, created or mapped</returns>
+	bool open(const std::string& path, size_t length, bool& created)
+	{
+		close();
+		created = false;
+
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND)
+		{
+			file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+			created = file != INVALID_HANDLE_VALUE;
+		}
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER current;
+		if (created)
+		{
+			current.QuadPart = static_cast<LONGLONG>(length);
+			if (!SetFilePointerEx(file, current, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+			{
+				close();
+				return false;
+			}
+		}
+		else if (!GetFileSizeEx(file, &current))
+		{
+			close();
+			return false;
+		}
+
+		// An empty file cannot be mapped, leave it open with no bytes
+		size = static_cast<size_t>(current.QuadPart);
+		if (size == 0) return true;
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+		if (!mapping)
+		{
+			close();
+			return false;
+		}
+
+		bytes = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+		if (!bytes)
+		{
+			close();
+			return false;
+		}
+#else
+		fd = ::open(path.c_str(), O_RDWR);
+		if (fd < 0 && errno == ENOENT)
+		{
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+			created = fd >= 0;
+		}
+		if (fd < 0) return false;
+
+		struct stat info;
+		if (created ? ftruncate(fd, static_cast<off_t>(length)) != 0 : fstat(fd, &info) != 0)
+		{
+			close();
+			return false;
+		}
+
+		// An empty file cannot be mapped, leave it open with no bytes
+		size = created ? length : static_cast<size_t>(info.st_size);
+		if (size == 0) return true;
+
+		void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			close();
+			return false;
+		}
+		bytes = static_cast<unsigned char*>(address);
+#endif
+
+		return true;
+	}
+
+	/// <summary>
+	/// Map an existing file read-only. The bytes must not be written.
+	/// </summary>
+	/// <param name="path">File to map</param>
+	/// <returns>False if the file is missing, empty or could not be mapped</returns>
+	bool open_read(const std::string& path)
+	{
+		close();
+
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER current;
+		if (!GetFileSizeEx(file, &current) || current.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+		{
+			close();
+			return false;
+		}
+
+		bytes = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!bytes)
+		{
+			close();
+			return false;
+		}
+
+		size = static_cast<size_t>(current.QuadPart);
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			close();
+			return false;
+		}
+
+		size = static_cast<size_t>(info.st_size);
+		void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			close();
+			return false;
+		}
+		bytes = static_cast<unsigned char*>(address);
+#endif
+
+		return true;
+	}
+
+	/// <summary>
+	/// Write dirty pages back to the file and wait for the disk
+	/// </summary>
+	/// <returns>False if the flush failed</returns>
+	bool flush()
+	{
+		if (!bytes) return false;
+
+#ifdef _WIN32
+		return FlushViewOfFile(bytes, size) && FlushFileBuffers(file);
+#else
+		return msync(bytes, size, MS_SYNC) == 0;
+#endif
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (bytes) munmap(bytes, size);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		bytes = nullptr;
+		size = 0;
+	}
+
+	bool is_open() const { return bytes != nullptr; }
+	unsigned char* data() { return bytes; }
+	const unsigned char* data() const { return bytes; }
+	size_t length() const { return size; }
+
+private:
+	unsigned char* bytes = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+#endif // !MAPPED_FILE_H
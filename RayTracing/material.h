@@ -3,26 +3,26 @@
 
 #include "rtweekend.h"
 
-struct hit_record;
+#include "hittable.h"
 
-class material
+#include <variant>
+#include <vector>
+
+/// <summary>
+/// Concrete type of a material, used to batch shading by type.
+/// The order matches the alternatives of material's variant.
+/// </summary>
+enum class material_kind
 {
-    public:
-        /// <summary>
-        /// Produce a scattered or absorbed ray.
-        /// If scattered, say how much attenuation is needed for the ray
-        /// </summary>
-        /// <param name="r_in">Incident ray</param>
-        /// <param name="rec">Hit record</param>
-        /// <param name="attenuation">Amount of attenuation</param>
-        /// <param name="scattered">Scattered ray</param>
-        /// <returns>True if scattered, false if miss</returns>
-        virtual bool scatter (
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const = 0;
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light
 };
 
-class lambertian : public material
+const int material_kind_count = 4;
+
+class lambertian
 {
     public:
         color albedo;
@@ -36,12 +36,13 @@ class lambertian : public material
         /// <param name="rec">Hit record</param>
         /// <param name="attenuation"></param>
         /// <param name="scattered"></param>
+        /// <param name="gen"></param>
         /// <returns>True if scattered, false if miss</returns>
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, rng& gen
+        ) const
         {
-            auto scatter_direction = rec.normal + random_unit_vector();
+            auto scatter_direction = rec.normal + random_unit_vector(gen);
 
             // Check for degenerate scatter direction
             if (scatter_direction.near_zero())
@@ -49,20 +50,20 @@ class lambertian : public material
                 scatter_direction = rec.normal;
             }
 
-            scattered = ray(rec.p, scatter_direction);
+            scattered = ray(rec.p, scatter_direction, r_in.time());
             attenuation = albedo;
             return true;
         }
 };
 
-class metal : public material
+class metal
 {
     public:
         color albedo;
-        double fuzz; // Fuzziness quotient for material
+        real fuzz; // Fuzziness quotient for material
 
-        metal(const color& a) : albedo(a) {}
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a) : albedo(a), fuzz(0.0) {}
+        metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
         /// <summary>
         /// Scatter ray when it hits a metal surface
@@ -71,24 +72,25 @@ class metal : public material
         /// <param name="rec">Hit record</param>
         /// <param name="attenuation"></param>
         /// <param name="scattered"></param>
+        /// <param name="gen"></param>
         /// <returns>True if scattered, false if miss</returns>
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, rng& gen
+        ) const
         {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere()); // Check scattering with fuzziness
+            scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere(gen), r_in.time()); // Check scattering with fuzziness
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         };
 };
 
-class dielectric : public material
+class dielectric
 {
     public:
-        double ir; // Index of refraction
+        real ir; // Index of refraction
 
-        dielectric(double refr_index) : ir(refr_index) {}
+        dielectric(real refr_index) : ir(refr_index) {}
 
         /// <summary>
         /// Scatter ray when it hits a dielectric surface
@@ -97,26 +99,27 @@ class dielectric : public material
         /// <param name="rec">Hit record</param>
         /// <param name="attenuation"></param>
         /// <param name="scattered"></param>
+        /// <param name="gen"></param>
         /// <returns>True if scattered, false if miss</returns>
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, rng& gen
+        ) const
         {
             attenuation = color(1.0, 1.0, 1.0);
 
-            double ratio_refr = rec.front_face ? (1.0 / ir) : ir; // Set ratio of refraction
+            real ratio_refr = rec.front_face ? (1.0 / ir) : ir; // Set ratio of refraction
 
             vec3 unit_dir = unit_vector(r_in.direction());
 
             // Get angles of refraction
-            double cos_theta = fmin(dot(-unit_dir, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+            real cos_theta = fmin(dot(-unit_dir, rec.normal), 1.0);
+            real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
             vec3 direction;
 
             // Check for total internal reflection
             bool can_refract = ratio_refr * sin_theta <= 1.0;
-            if (can_refract || reflectance(cos_theta, ratio_refr) > random_double())
+            if (can_refract || reflectance(cos_theta, ratio_refr) > random_double(gen))
             {
                 // Refract ray
                 direction = refract(unit_dir, rec.normal, ratio_refr);
@@ -129,13 +132,13 @@ class dielectric : public material
 
             vec3 refracted = refract(unit_dir, rec.normal, ratio_refr);
 
-            scattered = ray(rec.p, direction);
+            scattered = ray(rec.p, direction, r_in.time());
 
             return true;
         }
 
     private:
-        static double reflectance(double cos, double ref_idx)
+        static real reflectance(real cos, real ref_idx)
         {
             // Use Schlick's Approximation for reflectance
             auto r0 = (1.0 - ref_idx) / (1.0 + ref_idx);
@@ -144,4 +147,145 @@ class dielectric : public material
             return r0 + (1.0 - r0) * pow((1.0 - cos), 5);
         }
 };
+
+class diffuse_light
+{
+    public:
+        color emit; // Radiance leaving the front face
+
+        diffuse_light(const color& e) : emit(e) {}
+
+        /// <summary>
+        /// Light sources absorb every ray that reaches them
+        /// </summary>
+        /// <returns>False</returns>
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, rng& gen
+        ) const
+        {
+            return false;
+        }
+
+        /// <summary>
+        /// Radiance leaving the surface toward the ray's origin
+        /// </summary>
+        /// <param name="rec">Hit record</param>
+        /// <returns>Emission on the front face, black on the back</returns>
+        color emitted(const hit_record& rec) const
+        {
+            return rec.front_face ? emit : color(0.0, 0.0, 0.0);
+        }
+};
+
+/// <summary>
+/// A material of any type, stored by value. Scattering switches on the
+/// type tag instead of going through a virtual call.
+/// </summary>
+class material
+{
+    public:
+        material(const lambertian& m) : value(m) {}
+        material(const metal& m) : value(m) {}
+        material(const dielectric& m) : value(m) {}
+        material(const diffuse_light& m) : value(m) {}
+
+        material_kind kind() const { return static_cast<material_kind>(value.index()); }
+
+        /// <summary>
+        /// Access the concrete material. The caller must have checked kind().
+        /// </summary>
+        template <typename T>
+        const T& as() const { return *std::get_if<T>(&value); }
+
+        /// <summary>
+        /// Produce a scattered or absorbed ray.
+        /// If scattered, say how much attenuation is needed for the ray
+        /// </summary>
+        /// <param name="r_in">Incident ray</param>
+        /// <param name="rec">Hit record</param>
+        /// <param name="attenuation">Amount of attenuation</param>
+        /// <param name="scattered">Scattered ray</param>
+        /// <param name="gen">Random number generator for this path</param>
+        /// <returns>True if scattered, false if miss</returns>
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, rng& gen
+        ) const
+        {
+            switch (kind())
+            {
+                case material_kind::lambertian:
+                    return as<lambertian>().scatter(r_in, rec, attenuation, scattered, gen);
+                case material_kind::metal:
+                    return as<metal>().scatter(r_in, rec, attenuation, scattered, gen);
+                case material_kind::dielectric:
+                    return as<dielectric>().scatter(r_in, rec, attenuation, scattered, gen);
+                case material_kind::diffuse_light:
+                    return false;
+            }
+
+            return false;
+        }
+
+        /// <summary>
+        /// Radiance the surface emits toward the ray's origin, black unless it is a light
+        /// </summary>
+        /// <param name="rec">Hit record</param>
+        color emitted(const hit_record& rec) const
+        {
+            return kind() == material_kind::diffuse_light ? as<diffuse_light>().emitted(rec) : color(0.0, 0.0, 0.0);
+        }
+
+        /// <summary>
+        /// Surface color for feature buffers: the albedo of diffuse and
+        /// metal surfaces, white for glass and lights
+        /// </summary>
+        color albedo() const
+        {
+            switch (kind())
+            {
+                case material_kind::lambertian:
+                    return as<lambertian>().albedo;
+                case material_kind::metal:
+                    return as<metal>().albedo;
+                case material_kind::dielectric:
+                case material_kind::diffuse_light:
+                    break;
+            }
+
+            return color(1.0, 1.0, 1.0);
+        }
+
+    private:
+        std::variant<lambertian, metal, dielectric, diffuse_light> value;
+};
+
+/// <summary>
+/// Every material of a scene, addressed by the material_id stored in
+/// primitives and hit records
+/// </summary>
+class material_table
+{
+    public:
+        std::vector<material> materials;
+
+        /// <summary>
+        /// Add a material
+        /// </summary>
+        /// <param name="m">Material to add</param>
+        /// <returns>Id of the new material</returns>
+        material_id add(const material& m)
+        {
+            materials.push_back(m);
+            return static_cast<material_id>(materials.size() - 1);
+        }
+
+        size_t size() const { return materials.size(); }
+
+        /// <summary>
+        /// Bytes of the material array
+        /// </summary>
+        size_t storage_bytes() const { return materials.capacity() * sizeof(material); }
+
+        const material& operator[](material_id id) const { return materials[id]; }
+};
 #endif
\ No newline at end of file
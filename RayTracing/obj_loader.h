@@ -0,0 +1,188 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace obj_detail
+{
+	inline const char* skip_spaces(const char* s)
+	{
+		while (*s == ' ' || *s == '\t') ++s;
+		return s;
+	}
+
+	inline bool parse_vec3(const char* s, vec3& out)
+	{
+		char* end;
+		double v[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			v[k] = std::strtod(s, &end);
+			if (end == s) return false;
+			s = end;
+		}
+
+		out = vec3(v[0], v[1], v[2]);
+		return true;
+	}
+
+	/// <summary>
+	/// Turn a 1-based or negative (relative) OBJ index into a 0-based one
+	/// </summary>
+	inline bool resolve(long index, size_t count, uint32_t& out)
+	{
+		long resolved = index > 0 ? index - 1 : static_cast<long>(count) + index;
+		if (index == 0 || resolved < 0 || static_cast<size_t>(resolved) >= count) return false;
+
+		out = static_cast<uint32_t>(resolved);
+		return true;
+	}
+
+	struct corner
+	{
+		uint32_t position;
+		uint32_t normal;
+		bool has_normal;
+	};
+
+	/// <summary>
+	/// Parse a face corner: v, v/vt, v//vn or v/vt/vn
+	/// </summary>
+	inline bool parse_corner(const char*& s, const triangle_mesh& mesh, corner& out)
+	{
+		char* end;
+		long v = std::strtol(s, &end, 10);
+		if (end == s || !resolve(v, mesh.positions.size(), out.position)) return false;
+		s = end;
+
+		out.normal = 0;
+		out.has_normal = false;
+		if (*s != '/') return true;
+
+		++s;
+		if (*s != '/')
+		{
+			std::strtol(s, &end, 10); // Texture coordinates are not used
+			s = end;
+		}
+
+		if (*s != '/') return true;
+
+		++s;
+		long n = std::strtol(s, &end, 10);
+		if (end == s || !resolve(n, mesh.normals.size(), out.normal)) return false;
+		s = end;
+		out.has_normal = true;
+		return true;
+	}
+}
+
+/// <summary>
+/// Load a Wavefront OBJ file into a triangle mesh and build its BVH.
+/// The file is streamed line by line straight into the mesh's buffers;
+/// polygons are split into triangle fans. Vertex positions, vertex normals
+/// and faces are read, everything else (texture coordinates, groups,
+/// materials) is skipped, as is anything after a #. Normals are used only
+/// if every face has them.
+/// </summary>
+/// <param name="path">OBJ file</param>
+/// <param name="mesh">Mesh to fill</param>
+/// <returns>False if the file could not be read or has a bad face, which is printed</returns>
+inline bool load_obj(const std::string& path, triangle_mesh& mesh)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Could not open mesh " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	std::vector<obj_detail::corner> face;
+	bool all_normals = true;
+	int line_number = 0;
+
+	while (std::getline(file, line))
+	{
+		line_number++;
+
+		auto comment = line.find('#');
+		if (comment != std::string::npos) line.erase(comment);
+
+		const char* s = obj_detail::skip_spaces(line.c_str());
+
+		if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t'))
+		{
+			vec3 p;
+			if (!obj_detail::parse_vec3(s + 2, p))
+			{
+				std::cerr << path << ":" << line_number << ": bad vertex" << std::endl;
+				return false;
+			}
+			mesh.positions.push_back(p);
+		}
+		else if (s[0] == 'v' && s[1] == 'n' && (s[2] == ' ' || s[2] == '\t'))
+		{
+			vec3 n;
+			if (!obj_detail::parse_vec3(s + 3, n))
+			{
+				std::cerr << path << ":" << line_number << ": bad normal" << std::endl;
+				return false;
+			}
+			mesh.normals.push_back(n);
+		}
+		else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t'))
+		{
+			face.clear();
+			s = obj_detail::skip_spaces(s + 2);
+
+			while (*s != '\0' && *s != '\r')
+			{
+				obj_detail::corner c;
+				if (!obj_detail::parse_corner(s, mesh, c))
+				{
+					std::cerr << path << ":" << line_number << ": bad face" << std::endl;
+					return false;
+				}
+
+				face.push_back(c);
+				s = obj_detail::skip_spaces(s);
+			}
+
+			if (face.size() < 3)
+			{
+				std::cerr << path << ":" << line_number << ": face with fewer than 3 vertices" << std::endl;
+				return false;
+			}
+
+			for (size_t k = 1; k + 1 < face.size(); ++k)
+			{
+				const obj_detail::corner* tri[3] = { &face[0], &face[k], &face[k + 1] };
+				for (const auto* c : tri)
+				{
+					mesh.indices.push_back(c->position);
+					mesh.normal_indices.push_back(c->normal);
+					all_normals = all_normals && c->has_normal;
+				}
+			}
+		}
+	}
+
+	if (!all_normals)
+	{
+		mesh.normal_indices.clear();
+		mesh.normal_indices.shrink_to_fit();
+	}
+
+	mesh.build();
+	return true;
+}
+
+#endif // !OBJ_LOADER_H
@@ -0,0 +1,519 @@
+#ifndef PACKED_SPHERES_H
+#define PACKED_SPHERES_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/// <summary>
+/// Spheres stored as structure-of-arrays so one ray can be tested against
+/// simd_real::width spheres per instruction. The arrays are padded past
+/// the last sphere so a vector load starting at any sphere stays in bounds.
+/// Moving spheres keep their center at time 0 and a velocity; a ray finds
+/// every center at its own time with one multiply-add per coordinate.
+/// </summary>
+class packed_spheres : public hittable
+{
+public:
+	std::vector<real> center_x;
+	std::vector<real> center_y;
+	std::vector<real> center_z;
+	std::vector<real> radius;
+	std::vector<material_id> mat_id;
+	std::vector<real> velocity_x;
+	std::vector<real> velocity_y;
+	std::vector<real> velocity_z;
+
+	packed_spheres() { resize_storage(); }
+
+	static const size_t no_hit = ~size_t(0);
+
+	// Largest range intersect_range takes at once
+	static const size_t max_range = size_t(1) << 22;
+
+	size_t size() const { return count; }
+
+	/// <summary>
+	/// Make room for n spheres, so adding them does not reallocate
+	/// </summary>
+	void reserve(size_t n)
+	{
+		size_t padded = n + simd_real::width;
+		center_x.reserve(padded);
+		center_y.reserve(padded);
+		center_z.reserve(padded);
+		radius.reserve(padded);
+		mat_id.reserve(padded);
+		velocity_x.reserve(padded);
+		velocity_y.reserve(padded);
+		velocity_z.reserve(padded);
+	}
+
+	/// <summary>
+	/// Append a sphere
+	/// </summary>
+	/// <param name="center">Center of the sphere</param>
+	/// <param name="r">Radius, negative for hollow glass</param>
+	/// <param name="m">Material of the sphere</param>
+	/// <param name="velocity">Units per second, zero for a still sphere</param>
+	void add(const point3& center, real r, material_id m, const vec3& velocity = vec3(0.0, 0.0, 0.0))
+	{
+		size_t i = count++;
+		resize_storage();
+
+		center_x[i] = center.x();
+		center_y[i] = center.y();
+		center_z[i] = center.z();
+		radius[i] = r;
+		mat_id[i] = m;
+		velocity_x[i] = velocity.x();
+		velocity_y[i] = velocity.y();
+		velocity_z[i] = velocity.z();
+
+		has_motion = has_motion || velocity.x() != 0 || velocity.y() != 0 || velocity.z() != 0;
+	}
+
+	void add(const sphere& s) { add(s.center, s.radius, s.mat_id, s.velocity); }
+
+	/// <summary>
+	/// Replace the contents with n spheres copied from flat arrays
+	/// </summary>
+	void assign(size_t n, const real* x, const real* y, const real* z, const real* r, const material_id* m)
+	{
+		count = n;
+		center_x.clear();
+		center_y.clear();
+		center_z.clear();
+		radius.clear();
+		mat_id.clear();
+		velocity_x.clear();
+		velocity_y.clear();
+		velocity_z.clear();
+		has_motion = false;
+		resize_storage();
+
+		std::copy(x, x + n, center_x.begin());
+		std::copy(y, y + n, center_y.begin());
+		std::copy(z, z + n, center_z.begin());
+		std::copy(r, r + n, radius.begin());
+		std::copy(m, m + n, mat_id.begin());
+	}
+
+	/// <summary>
+	/// Bytes of the sphere arrays, padding and spare capacity included
+	/// </summary>
+	size_t storage_bytes() const
+	{
+		return (center_x.capacity() + center_y.capacity() + center_z.capacity() + radius.capacity() +
+			velocity_x.capacity() + velocity_y.capacity() + velocity_z.capacity()) * sizeof(real) +
+			mat_id.capacity() * sizeof(material_id);
+	}
+
+	point3 center(size_t i) const { return point3(center_x[i], center_y[i], center_z[i]); }
+
+	vec3 velocity(size_t i) const { return vec3(velocity_x[i], velocity_y[i], velocity_z[i]); }
+
+	/// <summary>
+	/// True if any sphere has a velocity
+	/// </summary>
+	bool moving() const { return has_motion; }
+
+	/// <summary>
+	/// Seconds from time 0 at a ray time of the current frame
+	/// </summary>
+	real motion_time(real time) const { return frame_time + frame_shutter * time; }
+
+	point3 center_at(size_t i, real time) const { return center(i) + motion_time(time) * velocity(i); }
+
+	/// <summary>
+	/// Copy every object of a list into packed storage
+	/// </summary>
+	/// <param name="list">Objects to pack</param>
+	/// <param name="out">Packed spheres</param>
+	/// <returns>False if the list holds anything other than spheres</returns>
+	static bool from_list(const hittable_list& list, packed_spheres& out)
+	{
+		for (const auto& object : list.objects)
+		{
+			auto s = dynamic_cast<const sphere*>(object.get());
+			if (!s) return false;
+
+			out.add(*s);
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Append every sphere to a list as a sphere object. The objects sit in
+	/// one array that the list's entries share, so they cost one allocation
+	/// and are freed together with the last entry.
+	/// </summary>
+	/// <param name="out">List receiving the spheres</param>
+	void to_list(hittable_list& out) const
+	{
+		auto storage = make_shared<std::vector<sphere>>();
+		storage->reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			storage->emplace_back(center(i), radius[i], mat_id[i], velocity(i));
+		}
+
+		out.objects.reserve(out.objects.size() + count);
+		for (sphere& s : *storage)
+		{
+			out.add(shared_ptr<hittable>(storage, &s));
+		}
+	}
+
+	/// <summary>
+	/// Intersect a ray with the spheres [first, first + n) a vector at a time.
+	/// Lanes count spheres from first in reals, so n must not exceed
+	/// max_range to keep them exact in single precision.
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="first">First sphere to test</param>
+	/// <param name="n">Number of spheres to test</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <param name="closest">Index of the nearest sphere hit, left untouched on a miss</param>
+	/// <returns>Distance to the nearest hit, t_max if nothing was hit</returns>
+	real intersect_range(const ray& r, size_t first, size_t n, real t_min, real t_max, size_t& closest) const
+	{
+		return has_motion ? intersect_range<true>(r, first, n, t_min, t_max, closest) : intersect_range<false>(r, first, n, t_min, t_max, closest);
+	}
+
+	template <bool Moving>
+	real intersect_range(const ray& r, size_t first, size_t n, real t_min, real t_max, size_t& closest) const
+	{
+		RT_STAT(thread_stats().sphere_tests += n);
+
+		const point3 o = r.origin();
+		const vec3 d = r.direction();
+
+		const simd_real ox(o.x()), oy(o.y()), oz(o.z());
+		const simd_real dx(d.x()), dy(d.y()), dz(d.z());
+		const simd_real a(d.length_squared());
+		const simd_real lo(t_min);
+		const simd_real end(static_cast<real>(n));
+		const simd_real time(motion_time(r.time()));
+
+		simd_real best_t(t_max);
+		simd_real best_index(-1.0);
+
+		for (size_t i = first; i < first + n; i += simd_real::width)
+		{
+			// Same quadratic and discriminant as sphere::hit, one sphere per lane
+			simd_real ocx = ox - simd_real::load(&center_x[i]);
+			simd_real ocy = oy - simd_real::load(&center_y[i]);
+			simd_real ocz = oz - simd_real::load(&center_z[i]);
+			if (Moving)
+			{
+				ocx = ocx - time * simd_real::load(&velocity_x[i]);
+				ocy = ocy - time * simd_real::load(&velocity_y[i]);
+				ocz = ocz - time * simd_real::load(&velocity_z[i]);
+			}
+			simd_real rad = simd_real::load(&radius[i]);
+
+			simd_real half_b = ocx * dx + ocy * dy + ocz * dz;
+			simd_real k = half_b / a;
+			simd_real lx = ocx - k * dx, ly = ocy - k * dy, lz = ocz - k * dz;
+			simd_real discriminant = a * (rad * rad - (lx * lx + ly * ly + lz * lz));
+
+			simd_real lane = simd_real::iota(static_cast<real>(i - first));
+			simd_mask candidates = (discriminant >= simd_real(0.0)) & (lane < end);
+			if (!candidates.any()) continue;
+
+			simd_real sqrtd = simd_sqrt(simd_max(discriminant, simd_real(0.0)));
+
+			// Nearest root in range, else the far root
+			simd_real near_root = (-half_b - sqrtd) / a;
+			simd_real far_root = (-half_b + sqrtd) / a;
+			simd_mask near_ok = (near_root >= lo) & (near_root <= best_t);
+			simd_mask far_ok = (far_root >= lo) & (far_root <= best_t);
+
+			simd_real root = simd_select(near_ok, near_root, far_root);
+			simd_mask accepted = candidates & (near_ok | far_ok);
+
+			best_t = simd_select(accepted, root, best_t);
+			best_index = simd_select(accepted, lane, best_index);
+		}
+
+		// Reduce the per-lane winners
+		real lane_t[simd_real::width];
+		real lane_index[simd_real::width];
+		best_t.store(lane_t);
+		best_index.store(lane_index);
+
+		real t = t_max;
+		for (int k = 0; k < simd_real::width; ++k)
+		{
+			if (lane_index[k] >= 0.0 && lane_t[k] <= t)
+			{
+				t = lane_t[k];
+				closest = first + static_cast<size_t>(lane_index[k]);
+			}
+		}
+
+		return t;
+	}
+
+	/// <summary>
+	/// Check whether any of the spheres [first, first + n) blocks a ray,
+	/// stopping at the first vector with a root in range
+	/// </summary>
+	/// <param name="r">Ray</param>
+	/// <param name="first">First sphere to test</param>
+	/// <param name="n">Number of spheres to test</param>
+	/// <param name="t_min">Minimum ray parameter</param>
+	/// <param name="t_max">Maximum ray parameter</param>
+	/// <returns>True if any sphere is hit in range</returns>
+	bool occluded_range(const ray& r, size_t first, size_t n, real t_min, real t_max) const
+	{
+		return has_motion ? occluded_range<true>(r, first, n, t_min, t_max) : occluded_range<false>(r, first, n, t_min, t_max);
+	}
+
+	template <bool Moving>
+	bool occluded_range(const ray& r, size_t first, size_t n, real t_min, real t_max) const
+	{
+		const point3 o = r.origin();
+		const vec3 d = r.direction();
+
+		const simd_real ox(o.x()), oy(o.y()), oz(o.z());
+		const simd_real dx(d.x()), dy(d.y()), dz(d.z());
+		const simd_real a(d.length_squared());
+		const simd_real lo(t_min), hi(t_max);
+		const simd_real end(static_cast<real>(n));
+		const simd_real time(motion_time(r.time()));
+
+		for (size_t i = first; i < first + n; i += simd_real::width)
+		{
+			RT_STAT(thread_stats().sphere_tests += std::min<size_t>(simd_real::width, first + n - i));
+
+			simd_real ocx = ox - simd_real::load(&center_x[i]);
+			simd_real ocy = oy - simd_real::load(&center_y[i]);
+			simd_real ocz = oz - simd_real::load(&center_z[i]);
+			if (Moving)
+			{
+				ocx = ocx - time * simd_real::load(&velocity_x[i]);
+				ocy = ocy - time * simd_real::load(&velocity_y[i]);
+				ocz = ocz - time * simd_real::load(&velocity_z[i]);
+			}
+			simd_real rad = simd_real::load(&radius[i]);
+
+			simd_real half_b = ocx * dx + ocy * dy + ocz * dz;
+			simd_real k = half_b / a;
+			simd_real lx = ocx - k * dx, ly = ocy - k * dy, lz = ocz - k * dz;
+			simd_real discriminant = a * (rad * rad - (lx * lx + ly * ly + lz * lz));
+
+			simd_real lane = simd_real::iota(static_cast<real>(i - first));
+			simd_mask candidates = (discriminant >= simd_real(0.0)) & (lane < end);
+			if (!candidates.any()) continue;
+
+			simd_real sqrtd = simd_sqrt(simd_max(discriminant, simd_real(0.0)));
+
+			// Either root in range blocks the ray
+			simd_real near_root = (-half_b - sqrtd) / a;
+			simd_real far_root = (-half_b + sqrtd) / a;
+			simd_mask near_ok = (near_root >= lo) & (near_root <= hi);
+			simd_mask far_ok = (far_root >= lo) & (far_root <= hi);
+
+			if ((candidates & (near_ok | far_ok)).any()) return true;
+		}
+
+		return false;
+	}
+
+	/// <summary>
+	/// Fill a hit record for a sphere found by intersect_range
+	/// </summary>
+	void fill_record(const ray& r, size_t i, real t, hit_record& rec) const
+	{
+		rec.t = t;
+		rec.p = r.at(t);
+
+		vec3 outward_normal = (rec.p - center_at(i, r.time())) / radius[i];
+		rec.set_face_normal(r, outward_normal);
+		rec.mat_id = mat_id[i];
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+	{
+		size_t closest = no_hit;
+		real t = t_max;
+		for (size_t first = 0; first < count; first += max_range)
+		{
+			t = intersect_range(r, first, std::min(max_range, count - first), t_min, t, closest);
+		}
+		if (closest == no_hit) return false;
+
+		fill_record(r, closest, t, rec);
+		return true;
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override
+	{
+		for (size_t first = 0; first < count; first += max_range)
+		{
+			if (occluded_range(r, first, std::min(max_range, count - first), t_min, t_max)) return true;
+		}
+
+		return false;
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		if (count == 0) return false;
+
+		output_box = aabb();
+		for (size_t i = 0; i < count; ++i)
+		{
+			output_box.expand(sphere_box(i));
+		}
+
+		return true;
+	}
+
+	virtual bool set_frame(real time, real shutter) override
+	{
+		if (!has_motion) return false;
+
+		frame_time = time;
+		frame_shutter = shutter;
+		return true;
+	}
+
+	virtual size_t memory_bytes() const override { return sizeof(*this) + storage_bytes(); }
+
+	/// <summary>
+	/// Box of a sphere over the current frame's shutter
+	/// </summary>
+	aabb sphere_box(size_t i) const
+	{
+		auto r = fabs(radius[i]);
+		point3 open = center_at(i, 0), close = center_at(i, 1);
+
+		aabb box(open - vec3(r, r, r), open + vec3(r, r, r));
+		box.expand(aabb(close - vec3(r, r, r), close + vec3(r, r, r)));
+		return box;
+	}
+
+private:
+	size_t count = 0;
+	bool has_motion = false;
+	real frame_time = 0;
+	real frame_shutter = 0;
+
+	void resize_storage()
+	{
+		// Padding lanes get a NaN radius, which fails every comparison
+		size_t padded = count + simd_real::width;
+		center_x.resize(padded, 0.0);
+		center_y.resize(padded, 0.0);
+		center_z.resize(padded, 0.0);
+		radius.resize(padded, std::numeric_limits<real>::quiet_NaN());
+		mat_id.resize(padded, 0);
+		velocity_x.resize(padded, 0.0);
+		velocity_y.resize(padded, 0.0);
+		velocity_z.resize(padded, 0.0);
+	}
+};
+
+/// <summary>
+/// BVH over packed spheres. Leaves hold up to 8 spheres stored next to each
+/// other, which a leaf tests in one or two vector passes.
+/// </summary>
+class packed_sphere_bvh : public hittable
+{
+public:
+	packed_spheres spheres;
+	bvh_tree tree;
+	frame_stamp frame;
+
+	static const int leaf_size = 8;
+
+	packed_sphere_bvh() {}
+
+	/// <summary>
+	/// Build from a packed set of spheres, reordered into leaf order
+	/// </summary>
+	/// <param name="src">Spheres to accelerate</param>
+	packed_sphere_bvh(const packed_spheres& src)
+	{
+		std::vector<aabb> boxes(src.size());
+		for (size_t i = 0; i < src.size(); ++i)
+		{
+			boxes[i] = src.sphere_box(i);
+		}
+
+		tree.build(boxes, leaf_size);
+
+		spheres.reserve(src.size());
+		for (int index : tree.indices)
+		{
+			spheres.add(src.center(index), src.radius[index], src.mat_id[index], src.velocity(index));
+		}
+	}
+
+	/// <summary>
+	/// Move the spheres to a frame and refit the tree around them, once per
+	/// frame however many instances place them
+	/// </summary>
+	virtual bool set_frame(real time, real shutter) override
+	{
+		if (frame.at(time, shutter)) return frame.moved;
+		if (!spheres.set_frame(time, shutter)) return frame.mark(time, shutter, false);
+
+		tree.refit([&](int k) { return spheres.sphere_box(static_cast<size_t>(k)); });
+		return frame.mark(time, shutter, true);
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+	{
+		size_t closest = packed_spheres::no_hit;
+		real closest_t = t_max;
+
+		bool hit_anything = tree.traverse(r, t_min, t_max, [&](int first, int count, real closest_so_far) {
+			size_t index = packed_spheres::no_hit;
+			real t = spheres.intersect_range(r, first, count, t_min, closest_so_far, index);
+			if (index != packed_spheres::no_hit && t < closest_so_far)
+			{
+				closest = index;
+				closest_t = t;
+			}
+
+			return t;
+		});
+
+		if (!hit_anything) return false;
+
+		spheres.fill_record(r, closest, closest_t, rec);
+		return true;
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override
+	{
+		return tree.any_hit(r, t_min, t_max, [&](int first, int count) {
+			return spheres.occluded_range(r, first, count, t_min, t_max);
+		});
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = tree.bounds();
+		return !tree.empty();
+	}
+
+	virtual size_t memory_bytes() const override { return sizeof(*this) + spheres.storage_bytes() + tree.storage_bytes(); }
+};
+
+#endif // !PACKED_SPHERES_H
@@ -0,0 +1,206 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "packed_spheres.h"
+#include "simd.h"
+#include "stats.h"
+
+#include <limits>
+
+/// <summary>
+/// Up to max_size rays traced together, stored as structure-of-arrays so
+/// that simd_real::width rays are tested per instruction. Lanes past size
+/// repeat the first ray with a negative t_max, which no box or sphere
+/// accepts, so every vector group can be processed whole.
+/// </summary>
+struct ray_packet
+{
+	static const int max_size = 16;
+	static_assert(max_size % simd_real::width == 0, "packets must fill whole vectors");
+
+	alignas(64) real ox[max_size], oy[max_size], oz[max_size];
+	alignas(64) real dx[max_size], dy[max_size], dz[max_size];
+	alignas(64) real inv_x[max_size], inv_y[max_size], inv_z[max_size];
+	alignas(64) real a[max_size];     // Squared length of each direction
+	alignas(64) real t_max[max_size]; // Closest hit so far per ray
+	size_t closest[max_size];         // Sphere hit per ray, packed_spheres::no_hit on a miss
+	int size = 0;
+
+	int groups() const { return (size + simd_real::width - 1) / simd_real::width; }
+
+	/// <summary>
+	/// Put a ray into a lane
+	/// </summary>
+	void set(int lane, const ray& r, real far = infinity)
+	{
+		const point3 o = r.origin();
+		const vec3 d = r.direction();
+
+		ox[lane] = o.x();
+		oy[lane] = o.y();
+		oz[lane] = o.z();
+		dx[lane] = d.x();
+		dy[lane] = d.y();
+		dz[lane] = d.z();
+		inv_x[lane] = 1 / d.x();
+		inv_y[lane] = 1 / d.y();
+		inv_z[lane] = 1 / d.z();
+		a[lane] = d.length_squared();
+		t_max[lane] = far;
+		closest[lane] = packed_spheres::no_hit;
+	}
+
+	/// <summary>
+	/// Fill the lanes after the last ray of a packet of n rays
+	/// </summary>
+	void finish(int n, const ray& first)
+	{
+		size = n;
+		for (int lane = n; lane < groups() * simd_real::width; ++lane)
+		{
+			set(lane, first, -1);
+		}
+	}
+};
+
+/// <summary>
+/// Slab test of every ray of a packet against a box, with the same far
+/// padding as aabb::hit
+/// </summary>
+/// <returns>True if any ray of the packet overlaps the box</returns>
+inline bool packet_hits_box(const aabb& box, const ray_packet& p, real t_min)
+{
+	const simd_real far_padding(static_cast<real>(1.0 + 2.0 * 3.0 * std::numeric_limits<real>::epsilon() / (1.0 - 3.0 * std::numeric_limits<real>::epsilon())));
+	const simd_real lo_x(box.minimum.x()), lo_y(box.minimum.y()), lo_z(box.minimum.z());
+	const simd_real hi_x(box.maximum.x()), hi_y(box.maximum.y()), hi_z(box.maximum.z());
+	const simd_real near_limit(t_min);
+
+	for (int g = 0; g < p.groups(); ++g)
+	{
+		int lane = g * simd_real::width;
+		simd_real ox = simd_real::load(&p.ox[lane]), oy = simd_real::load(&p.oy[lane]), oz = simd_real::load(&p.oz[lane]);
+		simd_real ix = simd_real::load(&p.inv_x[lane]), iy = simd_real::load(&p.inv_y[lane]), iz = simd_real::load(&p.inv_z[lane]);
+
+		simd_real x0 = (lo_x - ox) * ix, x1 = (hi_x - ox) * ix;
+		simd_real y0 = (lo_y - oy) * iy, y1 = (hi_y - oy) * iy;
+		simd_real z0 = (lo_z - oz) * iz, z1 = (hi_z - oz) * iz;
+
+		simd_real t_near = simd_max(simd_max(simd_min(x0, x1), simd_min(y0, y1)), simd_max(simd_min(z0, z1), near_limit));
+		simd_real t_far = simd_min(simd_min(simd_max(x0, x1), simd_max(y0, y1)), simd_max(z0, z1)) * far_padding;
+		t_far = simd_min(t_far, simd_real::load(&p.t_max[lane]));
+
+		if ((t_near <= t_far).any()) return true;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Intersect every ray of a packet with the spheres [first, first + n),
+/// one sphere at a time across the rays. The per-ray arithmetic is that of
+/// packed_spheres::intersect_range, so each ray finds the same hit it
+/// would find alone.
+/// </summary>
+inline void intersect_packet(const packed_spheres& spheres, size_t first, size_t n, ray_packet& p, real t_min)
+{
+	RT_STAT(thread_stats().sphere_tests += n * static_cast<uint64_t>(p.size));
+
+	const simd_real lo(t_min);
+	const simd_real zero(0.0);
+
+	for (size_t i = first; i < first + n; ++i)
+	{
+		const simd_real cx(spheres.center_x[i]), cy(spheres.center_y[i]), cz(spheres.center_z[i]);
+		const simd_real rad(spheres.radius[i]);
+
+		for (int g = 0; g < p.groups(); ++g)
+		{
+			int lane = g * simd_real::width;
+			simd_real dx = simd_real::load(&p.dx[lane]), dy = simd_real::load(&p.dy[lane]), dz = simd_real::load(&p.dz[lane]);
+			simd_real a = simd_real::load(&p.a[lane]);
+
+			simd_real ocx = simd_real::load(&p.ox[lane]) - cx;
+			simd_real ocy = simd_real::load(&p.oy[lane]) - cy;
+			simd_real ocz = simd_real::load(&p.oz[lane]) - cz;
+
+			simd_real half_b = ocx * dx + ocy * dy + ocz * dz;
+			simd_real k = half_b / a;
+			simd_real lx = ocx - k * dx, ly = ocy - k * dy, lz = ocz - k * dz;
+			simd_real discriminant = a * (rad * rad - (lx * lx + ly * ly + lz * lz));
+
+			simd_mask candidates = discriminant >= zero;
+			if (!candidates.any()) continue;
+
+			simd_real best_t = simd_real::load(&p.t_max[lane]);
+			simd_real sqrtd = simd_sqrt(simd_max(discriminant, zero));
+
+			simd_real near_root = (-half_b - sqrtd) / a;
+			simd_real far_root = (-half_b + sqrtd) / a;
+			simd_mask near_ok = (near_root >= lo) & (near_root <= best_t);
+			simd_mask far_ok = (far_root >= lo) & (far_root <= best_t);
+
+			simd_mask accepted = candidates & (near_ok | far_ok);
+			int bits = accepted.bits();
+			if (bits == 0) continue;
+
+			simd_select(accepted, simd_select(near_ok, near_root, far_root), best_t).store(&p.t_max[lane]);
+			for (int k_lane = 0; k_lane < simd_real::width; ++k_lane)
+			{
+				if (bits & (1 << k_lane)) p.closest[lane + k_lane] = i;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Trace a packet through a sphere BVH. A node is entered when any ray of
+/// the packet overlaps it inside that ray's closest hit so far, so the
+/// whole packet skips a subtree with one box test per vector when every
+/// ray misses it. Children are visited in the order of the first ray.
+/// </summary>
+/// <param name="world">Sphere BVH</param>
+/// <param name="p">Packet, t_max and closest are updated per ray</param>
+/// <param name="t_min">Minimum ray parameter</param>
+inline void hit_packet(const packed_sphere_bvh& world, ray_packet& p, real t_min)
+{
+	const bvh_tree& tree = world.tree;
+	if (tree.empty()) return;
+
+	const bool dir_negative[3] = { p.dx[0] < 0, p.dy[0] < 0, p.dz[0] < 0 };
+
+	int stack[bvh_tree::max_depth + 4];
+	int stack_size = 0;
+	int current = 0;
+
+	while (true)
+	{
+		const bvh_flat_node& node = tree.nodes[current];
+		RT_STAT(thread_stats().box_tests += static_cast<uint64_t>(p.size));
+
+		if (packet_hits_box(node.box, p, t_min))
+		{
+			if (node.is_leaf())
+			{
+				intersect_packet(world.spheres, static_cast<size_t>(node.offset), static_cast<size_t>(node.count), p, t_min);
+			}
+			else
+			{
+				int first = current + 1;
+				int second = node.offset;
+				if (dir_negative[node.axis]) std::swap(first, second);
+
+				stack[stack_size++] = second;
+				current = first;
+				continue;
+			}
+		}
+
+		if (stack_size == 0) break;
+		current = stack[--stack_size];
+	}
+}
+
+#endif // !PACKET_H
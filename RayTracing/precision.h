@@ -0,0 +1,17 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+/// <summary>
+/// Scalar type of all geometry: vectors, rays, cameras, hit records,
+/// bounding boxes and packed primitives. Define RT_FLOAT to build in
+/// single precision, which halves the size of everything the traversal
+/// and intersection loops read. Accumulation (framebuffer, checkpoints,
+/// error estimates) and random numbers stay in double either way.
+/// </summary>
+#ifdef RT_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+#endif // !PRECISION_H
@@ -0,0 +1,341 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "color.h"
+#include "framebuffer.h"
+#include "render_settings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Live preview: every tile is sent as soon as a pass over it finishes, so
+// a viewer can show the image while it renders. The stream is a sequence
+// of messages, each a tile_message header in native byte order followed,
+// for tiles, by width * height * 3 bytes of gamma-corrected 8-bit RGB in
+// rows from the top of the image down:
+//
+//   frame_begin  width and height are the image size
+//   tile         x and y are the tile's top-left pixel counted from the
+//                image's top-left, samples the fewest any of its pixels has
+//   frame_end    the frame is final
+//
+// A later message for the same tile replaces the earlier one.
+
+namespace preview_detail
+{
+	const uint32_t magic = 0x4C545452; // "RTTL"
+
+	enum message_type : uint32_t
+	{
+		frame_begin = 0,
+		tile = 1,
+		frame_end = 2
+	};
+}
+
+/// <summary>
+/// Header of every preview message
+/// </summary>
+struct tile_message
+{
+	uint32_t magic;
+	uint32_t type;
+	int32_t frame;
+	int32_t x, y;
+	int32_t width, height;
+	int32_t samples;
+};
+
+/// <summary>
+/// Sends tiles to a viewer from a background thread, so render threads
+/// only pay for converting their tile to 8 bits. If the viewer goes away
+/// the stream turns itself off and the render carries on.
+/// </summary>
+class tile_stream
+{
+public:
+	tile_stream() = default;
+
+	~tile_stream() { close(); }
+
+	tile_stream(const tile_stream&) = delete;
+	tile_stream& operator=(const tile_stream&) = delete;
+
+	/// <summary>
+	/// Connect to the viewer
+	/// </summary>
+	/// <param name="target">"-" for stdout, "unix:PATH" for a Unix socket, "tcp:PORT" for a port on
+	/// localhost, anything else a file or named pipe to write</param>
+	/// <returns>False if the target could not be opened, which is printed</returns>
+	bool open(const std::string& target)
+	{
+		close();
+
+		if (target == "-")
+		{
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			out = stdout;
+		}
+		else if (target.rfind("unix:", 0) == 0 || target.rfind("tcp:", 0) == 0)
+		{
+#ifdef _WIN32
+			std::fprintf(stderr, "Preview sockets are not supported on Windows\n");
+			return false;
+#else
+			int fd = connect_socket(target);
+			if (fd < 0)
+			{
+				std::fprintf(stderr, "Could not connect to %s\n", target.c_str());
+				return false;
+			}
+			out = ::fdopen(fd, "wb");
+			if (!out) ::close(fd);
+#endif
+		}
+		else
+		{
+			out = std::fopen(target.c_str(), "wb");
+		}
+
+		if (!out)
+		{
+			std::fprintf(stderr, "Could not open %s\n", target.c_str());
+			return false;
+		}
+
+#ifndef _WIN32
+		// A viewer that closes its end must not kill the render
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+		stopping = false;
+		broken = false;
+		worker = std::thread([this] { run(); });
+		return true;
+	}
+
+	/// <summary>
+	/// True while tiles are being sent
+	/// </summary>
+	bool is_open() const { return out != nullptr; }
+
+	/// <summary>
+	/// Start a frame
+	/// </summary>
+	/// <param name="frame">Frame number</param>
+	/// <param name="width">Image width</param>
+	/// <param name="height">Image height</param>
+	void begin_frame(int frame, int width, int height)
+	{
+		first_tile = -1.0;
+		frame_start = std::chrono::steady_clock::now();
+		current_frame = frame;
+		push({ preview_detail::magic, preview_detail::frame_begin, frame, 0, 0, width, height, 0 }, {});
+	}
+
+	/// <summary>
+	/// Queue the current state of a tile; called from the render threads
+	/// </summary>
+	/// <param name="t">Tile that finished a pass</param>
+	/// <param name="image">Framebuffer holding it</param>
+	void send_tile(const tile& t, const framebuffer& image)
+	{
+		const int w = t.x1 - t.x0, h = t.y1 - t.y0;
+		std::vector<unsigned char> rgb(static_cast<size_t>(w) * h * 3);
+		uint32_t fewest = UINT32_MAX;
+
+		// Framebuffer row 0 is the bottom of the image
+		unsigned char* p = rgb.data();
+		for (int j = t.y1 - 1; j >= t.y0; --j)
+		{
+			for (int i = t.x0; i < t.x1; ++i, p += 3)
+			{
+				write_color(p, image.average(i, j));
+				fewest = std::min(fewest, image.samples(i, j));
+			}
+		}
+
+		push({ preview_detail::magic, preview_detail::tile, current_frame, t.x0, image.height - t.y1, w, h,
+			static_cast<int32_t>(fewest) }, std::move(rgb));
+	}
+
+	/// <summary>
+	/// Finish a frame
+	/// </summary>
+	/// <param name="frame">Frame number</param>
+	void end_frame(int frame)
+	{
+		push({ preview_detail::magic, preview_detail::frame_end, frame, 0, 0, 0, 0, 0 }, {});
+	}
+
+	/// <summary>
+	/// Seconds from begin_frame until the first tile of the frame was queued, negative if none was
+	/// </summary>
+	double time_to_first_tile()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return first_tile;
+	}
+
+	/// <summary>
+	/// Send what is queued and disconnect
+	/// </summary>
+	void close()
+	{
+		if (!out) return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		worker.join();
+
+		if (out != stdout) std::fclose(out);
+		else std::fflush(out);
+		out = nullptr;
+	}
+
+private:
+	struct message
+	{
+		tile_message header;
+		std::vector<unsigned char> payload;
+	};
+
+	std::FILE* out = nullptr;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<message> messages;
+	bool stopping = false;
+	bool broken = false;
+	int current_frame = 0;
+	std::chrono::steady_clock::time_point frame_start;
+	double first_tile = -1.0;
+	std::thread worker;
+
+	void push(const tile_message& header, std::vector<unsigned char> payload)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (broken || !out) return;
+
+			if (header.type == preview_detail::tile && first_tile < 0.0)
+			{
+				first_tile = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+			}
+
+			// A viewer that falls behind only needs the newest copy of a tile
+			if (header.type == preview_detail::tile)
+			{
+				for (auto& queued : messages)
+				{
+					if (queued.header.type == preview_detail::tile && queued.header.frame == header.frame &&
+						queued.header.x == header.x && queued.header.y == header.y)
+					{
+						queued.header = header;
+						queued.payload = std::move(payload);
+						return;
+					}
+				}
+			}
+
+			messages.push_back({ header, std::move(payload) });
+		}
+		changed.notify_all();
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true)
+		{
+			changed.wait(lock, [this] { return stopping || !messages.empty(); });
+			if (messages.empty()) return;
+
+			message next = std::move(messages.front());
+			messages.pop_front();
+			bool last = messages.empty();
+
+			lock.unlock();
+			bool ok = std::fwrite(&next.header, sizeof(next.header), 1, out) == 1 &&
+				(next.payload.empty() || std::fwrite(next.payload.data(), next.payload.size(), 1, out) == 1);
+			if (ok && last) ok = std::fflush(out) == 0;
+			lock.lock();
+
+			if (!ok)
+			{
+				std::fprintf(stderr, "Preview viewer went away, no more tiles are sent\n");
+				broken = true;
+				messages.clear();
+			}
+		}
+	}
+
+#ifndef _WIN32
+	static int connect_socket(const std::string& target)
+	{
+		if (target.rfind("unix:", 0) == 0)
+		{
+			std::string path = target.substr(5);
+			sockaddr_un address = {};
+			if (path.empty() || path.size() >= sizeof(address.sun_path)) return -1;
+
+			address.sun_family = AF_UNIX;
+			std::copy(path.begin(), path.end(), address.sun_path);
+
+			int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0) return -1;
+			if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				::close(fd);
+				return -1;
+			}
+			return fd;
+		}
+
+		int port = std::atoi(target.c_str() + 4);
+		if (port <= 0 || port > 65535) return -1;
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(static_cast<uint16_t>(port));
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+		{
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+#endif
+};
+
+#endif // !PREVIEW_H
@@ -0,0 +1,120 @@
+#ifndef RANDOM_SCENE_H
+#define RANDOM_SCENE_H
+
+#include "rtweekend.h"
+
+#include "material.h"
+#include "packed_spheres.h"
+#include "scene.h"
+
+/// <summary>
+/// The book's final scene: a ground sphere, three large spheres and small
+/// spheres with random materials on a (2 * grid)^2 lattice around them
+/// </summary>
+/// <param name="materials">Material table receiving the scene's materials</param>
+/// <param name="grid">Half the lattice's edge, 11 gives the book's 484 sites</param>
+/// <param name="moving">Give the small diffuse spheres a velocity along the ground</param>
+/// <returns>Spheres of the scene, stored flat</returns>
+inline packed_spheres random_scene(material_table& materials, int grid = 11, bool moving = false)
+{
+	packed_spheres spheres;
+	spheres.reserve(static_cast<size_t>(4 * grid * grid + 4));
+
+	// Scene layout draws from its own stream, away from every pixel's numbers,
+	// and velocities from another so that the layout does not depend on them
+	rng gen(~0ull);
+	rng motion(~0ull - 2);
+
+	auto ground_material = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+	spheres.add(point3(0.0, -1000.0, 0.0), 1000.0, ground_material);
+
+	for (int a = -grid; a < grid; a++)
+	{
+		for (int b = -grid; b < grid; b++)
+		{
+			auto choose_mat = random_double(gen);
+			point3 center(a + 0.9 * random_double(gen), 0.2, b + 0.9 * random_double(gen));
+
+			if ((center - point3(4.0, 0.2, 0.0)).length() > 0.9)
+			{
+				material_id sphere_material;
+
+				if (choose_mat < 0.8)
+				{
+					// Diffuse material
+					auto albedo = color::random(gen) * color::random(gen);
+					sphere_material = materials.add(lambertian(albedo));
+
+					vec3 velocity(0.0, 0.0, 0.0);
+					if (moving)
+					{
+						vec3 d = random_in_unit_disk(motion);
+						velocity = vec3(d.x(), 0.0, d.y());
+					}
+					spheres.add(center, 0.2, sphere_material, velocity);
+				}
+				else if (choose_mat < 0.95)
+				{
+					// metal material
+					auto albedo = color::random(0.5, 1.0, gen);
+					auto fuzz = random_double(0, 0.5, gen);
+					sphere_material = materials.add(metal(albedo, fuzz));
+					spheres.add(center, 0.2, sphere_material);
+				}
+				else
+				{
+					// Glass material
+					sphere_material = materials.add(dielectric(1.5));
+					spheres.add(center, 0.2, sphere_material);
+				}
+			}
+		}
+	}
+
+	auto material1 = materials.add(dielectric(1.5));
+	spheres.add(point3(0.0, 1.0, 0.0), 1.0, material1);
+
+	auto material2 = materials.add(lambertian(color(0.4, 0.2, 0.1)));
+	spheres.add(point3(-4.0, 1.0, 0.0), 1.0, material2);
+
+	auto material3 = materials.add(metal(color(0.7, 0.6, 0.5), 0.0));
+	spheres.add(point3(4.0, 1.0, 0.0), 1.0, material3);
+
+	return spheres;
+}
+
+/// <summary>
+/// The built-in scene: the random spheres plus a few larger ones in front
+/// </summary>
+/// <param name="out">Scene to fill</param>
+/// <param name="moving">Let the small diffuse spheres move</param>
+inline void default_scene(scene& out, bool moving = false)
+{
+	material_table& materials = out.materials;
+	packed_spheres& spheres = out.spheres;
+	spheres = random_scene(materials, 11, moving);
+
+	// Make materials for world
+	auto material_ground = materials.add(lambertian(color(0.8, 0.8, 0.0)));
+	auto material_center = materials.add(lambertian(color(0.1, 0.2, 0.5)));
+	auto material_left = materials.add(dielectric(1.5));
+	auto material_right = materials.add(metal(color(0.8, 0.6, 0.2), 0.0));
+
+	// Add objects with materials to world
+	spheres.add(point3(0.0, -100.5, -1.0), 100.0, material_ground);
+	spheres.add(point3(0.0, 0.0, -1.0), 0.5, material_center);
+	spheres.add(point3(-1.0, 0.0, -1.0), 0.5, material_left);
+	spheres.add(point3(-1.0, 0.0, -1.0), -0.45, material_left);
+	spheres.add(point3(1.0, 0.0, -1.0), 0.5, material_right);
+
+	// Camera
+	out.view.lookfrom = point3(13.0, 2.0, 3.0);
+	out.view.lookat = point3(0.0, 0.0, 0.0);
+	out.view.up = vec3(0.0, 1.0, 0.0);
+	out.view.vfov = 20.0;
+	out.view.aspect = 3.0 / 2.0;
+	out.view.aperture = 0.1;
+	out.view.focus_distance = 10.0;
+}
+
+#endif // !RANDOM_SCENE_H
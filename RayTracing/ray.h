@@ -8,7 +8,7 @@ class ray
     public:
         point3 orig;
         vec3 dir;
-        double tm;
+        real tm;
 
         ray() {}
 
@@ -16,15 +16,15 @@ class ray
             : orig(origin), dir(direction), tm(0)
         {}
 
-        ray(const point3& origin, const vec3& direction, double time)
+        ray(const point3& origin, const vec3& direction, real time)
             : orig(origin), dir(direction), tm(time)
         {}
 
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
-        double time() const { return tm; }
+        real time() const { return tm; }
 
-        point3 at(double t) const
+        point3 at(real t) const
         {
             return orig + t * dir;
         }
@@ -0,0 +1,385 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "environment.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "packet.h"
+#include "render_settings.h"
+#include "roulette.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "wavefront.h"
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+/// <summary>
+/// Continue a path from its first hit, bounce by bounce, carrying the
+/// product of the attenuations. Diffuse surfaces also aim a shadow ray at
+/// a light; light that scattering finds is then weighed against it.
+/// </summary>
+/// <param name="r">Ray that made the hit</param>
+/// <param name="hit">Where the ray hit</param>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="depth">Maximum number of bounces, at least 1</param>
+/// <param name="roulette_depth">Bounces before Russian roulette may end the path</param>
+/// <param name="gen">Random number generator for this path</param>
+/// <returns>Color</returns>
+color ray_color_from_hit(const ray& r, const hit_record& hit, const hittable& world, const material_table& materials, const light_list& lights,
+	int depth, int roulette_depth, rng& gen)
+{
+	ray current = r;
+	hit_record rec = hit;
+	color throughput(1.0, 1.0, 1.0);
+	color radiance(0.0, 0.0, 0.0);
+	real scatter_pdf = 0; // Density of the last scattered direction if that bounce also aimed at a light
+
+	for (int bounce = 1; ; ++bounce)
+	{
+		ray scattered;
+		color attenuation;
+		const material& m = materials[rec.mat_id];
+
+		if (m.kind() == material_kind::diffuse_light)
+		{
+			radiance += throughput * m.emitted(rec) * emission_weight(lights, scatter_pdf, current, rec);
+		}
+
+		gen.next_bounce();
+
+		bool scatters = m.scatter(current, rec, attenuation, scattered, gen);
+		RT_STAT(thread_stats().hit_material(static_cast<int>(m.kind()), scatters));
+
+		if (!scatters)
+		{
+			RT_STAT(thread_stats().end_path(bounce));
+			return radiance;
+		}
+
+		scatter_pdf = 0;
+		if (m.kind() == material_kind::lambertian && !lights.empty())
+		{
+			radiance += throughput * sample_direct_light(lights, world, rec, attenuation, current.time(), gen);
+			scatter_pdf = lambertian_pdf(rec, scattered.direction());
+		}
+
+		throughput = throughput * attenuation;
+		current = scattered;
+
+		if (!russian_roulette(throughput, bounce, roulette_depth, gen))
+		{
+			RT_STAT(thread_stats().end_path(bounce));
+			return radiance;
+		}
+
+		// Out of bounces: estimate the rest of the path with the sky it would
+		// most likely reach rather than dropping its light
+		if (bounce >= depth)
+		{
+			RT_STAT(thread_stats().end_path(bounce));
+			return radiance + throughput * lights.sky(current) * sky_weight(lights, scatter_pdf, current);
+		}
+
+		// Check if ray hits target and prevent shadow acne
+		RT_STAT(thread_stats().trace_ray(bounce));
+		if (!world.hit(current, 0.001, infinity, rec))
+		{
+			RT_STAT(thread_stats().end_path(bounce + 1));
+			return radiance + throughput * lights.sky(current) * sky_weight(lights, scatter_pdf, current);
+		}
+	}
+}
+
+/// <summary>
+/// Set the color of the ray given a world of hittable objects
+/// </summary>
+/// <param name="r">Ray</param>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="depth">Maximum number of bounces</param>
+/// <param name="roulette_depth">Bounces before Russian roulette may end the path</param>
+/// <param name="gen">Random number generator for this path</param>
+/// <returns>Color</returns>
+color ray_color(const ray& r, const hittable& world, const material_table& materials, const light_list& lights, int depth, int roulette_depth, rng& gen)
+{
+	hit_record rec;
+	if (depth <= 0)
+	{
+		RT_STAT(thread_stats().end_path(0));
+		return lights.sky(r);
+	}
+
+	RT_STAT(thread_stats().trace_ray(0));
+	if (!world.hit(r, 0.001, infinity, rec))
+	{
+		RT_STAT(thread_stats().end_path(1));
+		return lights.sky(r);
+	}
+
+	return ray_color_from_hit(r, rec, world, materials, lights, depth, roulette_depth, gen);
+}
+
+/// <summary>
+/// Trace one pass of samples for every pixel in a tile into the framebuffer.
+/// Each sample draws from a generator keyed on its pixel and sample index,
+/// so a tile renders the same no matter which thread picks it up, and a
+/// resumed render continues exactly where the saved one stopped.
+/// </summary>
+/// <param name="t">Tile to render</param>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings</param>
+/// <param name="image">Framebuffer receiving the sample sums</param>
+inline void render_tile(const tile& t, const hittable& world, const material_table& materials, const light_list& lights, const camera& cam,
+	const render_settings& settings, framebuffer& image)
+{
+	for (int j = t.y0; j < t.y1; ++j)
+	{
+		for (int i = t.x0; i < t.x1; ++i)
+		{
+			int first = static_cast<int>(image.samples(i, j));
+			int count = pass_sample_count(image, i, j, settings);
+			if (count <= 0) continue;
+
+			color pixel_color(0.0, 0.0, 0.0);
+			double luminance_sq = 0.0;
+
+			// Antialiase image
+			for (int s = first; s < first + count; ++s)
+			{
+				rng gen = pixel_rng(settings, i, j, s);
+
+				// Send rays through each sample of a pixel and then average them for the pixel
+				auto u = (i + random_double(gen)) / (settings.width - 1);
+				auto v = (j + random_double(gen)) / (settings.height - 1);
+
+				ray r = cam.get_ray(u, v, gen); // Shoot ray
+				color sample = ray_color(r, world, materials, lights, settings.max_depth, settings.roulette_depth, gen); // Find color of pixel
+				pixel_color += sample;
+				luminance_sq += luminance(sample) * luminance(sample);
+			}
+
+			image.add(i, j, pixel_color, luminance_sq, count);
+		}
+	}
+}
+
+/// <summary>
+/// Trace one pass of a tile like render_tile, but shoot the camera rays in
+/// packets of settings.packet_size from small pixel blocks (2x2 for 4, 4x2
+/// for 8, 4x4 for 16) and trace each packet through the sphere BVH at once.
+/// Bounces after the first hit are traced one ray at a time. Every sample
+/// keeps its own generator and finds the same first hit as it would alone,
+/// so the image matches render_tile.
+/// </summary>
+/// <param name="t">Tile to render</param>
+/// <param name="packed">The world as a sphere BVH, for the camera rays</param>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings</param>
+/// <param name="image">Framebuffer receiving the sample sums</param>
+inline void render_tile_packets(const tile& t, const packed_sphere_bvh& packed, const hittable& world, const material_table& materials,
+	const light_list& lights, const camera& cam, const render_settings& settings, framebuffer& image)
+{
+	const int packet_size = std::min(settings.packet_size, ray_packet::max_size);
+	int block_height = 1;
+	while (4 * block_height * block_height <= packet_size) block_height *= 2;
+	const int block_width = packet_size / block_height;
+
+	struct block_pixel
+	{
+		int i, j;
+		int first, count;
+		color sum;
+		double luminance_sq;
+	};
+
+	struct packet_sample
+	{
+		int pixel;
+		int sample;
+	};
+
+	block_pixel pixels[ray_packet::max_size];
+	std::vector<packet_sample> samples;
+	ray_packet packet;
+	ray rays[ray_packet::max_size];
+	rng gens[ray_packet::max_size];
+
+	for (int by = t.y0; by < t.y1; by += block_height)
+	{
+		for (int bx = t.x0; bx < t.x1; bx += block_width)
+		{
+			int pixel_count = 0;
+			int most = 0;
+			for (int j = by; j < std::min(by + block_height, t.y1); ++j)
+			{
+				for (int i = bx; i < std::min(bx + block_width, t.x1); ++i)
+				{
+					int count = pass_sample_count(image, i, j, settings);
+					if (count <= 0) continue;
+
+					pixels[pixel_count++] = { i, j, static_cast<int>(image.samples(i, j)), count, color(0.0, 0.0, 0.0), 0.0 };
+					most = std::max(most, count);
+				}
+			}
+
+			// Neighbouring pixels at the same sample index go into one packet
+			samples.clear();
+			for (int s = 0; s < most; ++s)
+			{
+				for (int k = 0; k < pixel_count; ++k)
+				{
+					if (s < pixels[k].count) samples.push_back({ k, pixels[k].first + s });
+				}
+			}
+
+			for (size_t start = 0; start < samples.size(); start += packet_size)
+			{
+				int n = static_cast<int>(std::min(samples.size() - start, static_cast<size_t>(packet_size)));
+
+				for (int lane = 0; lane < n; ++lane)
+				{
+					const block_pixel& px = pixels[samples[start + lane].pixel];
+					gens[lane] = pixel_rng(settings, px.i, px.j, samples[start + lane].sample);
+
+					auto u = (px.i + random_double(gens[lane])) / (settings.width - 1);
+					auto v = (px.j + random_double(gens[lane])) / (settings.height - 1);
+
+					rays[lane] = cam.get_ray(u, v, gens[lane]);
+					packet.set(lane, rays[lane]);
+					RT_STAT(thread_stats().trace_ray(0));
+				}
+				packet.finish(n, rays[0]);
+
+				hit_packet(packed, packet, 0.001);
+
+				for (int lane = 0; lane < n; ++lane)
+				{
+					color sample;
+					if (packet.closest[lane] == packed_spheres::no_hit)
+					{
+						sample = lights.sky(rays[lane]);
+						RT_STAT(thread_stats().end_path(1));
+					}
+					else
+					{
+						hit_record rec;
+						packed.spheres.fill_record(rays[lane], packet.closest[lane], packet.t_max[lane], rec);
+						sample = ray_color_from_hit(rays[lane], rec, world, materials, lights, settings.max_depth, settings.roulette_depth, gens[lane]);
+					}
+
+					block_pixel& px = pixels[samples[start + lane].pixel];
+					px.sum += sample;
+					px.luminance_sq += luminance(sample) * luminance(sample);
+				}
+			}
+
+			for (int k = 0; k < pixel_count; ++k)
+			{
+				image.add(pixels[k].i, pixels[k].j, pixels[k].sum, pixels[k].luminance_sq, pixels[k].count);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// The world as a sphere BVH when camera rays can be traced in packets
+/// through it, otherwise null. Packets share one time, so moving spheres
+/// are traced ray by ray.
+/// </summary>
+inline const packed_sphere_bvh* packet_world(const hittable& world, const render_settings& settings)
+{
+	if (settings.packet_size <= 1 || settings.max_depth <= 0) return nullptr;
+
+	auto packed = dynamic_cast<const packed_sphere_bvh*>(&world);
+	return packed && !packed->spheres.moving() ? packed : nullptr;
+}
+
+/// <summary>
+/// Trace one pass of a tile with the integrator the settings ask for
+/// </summary>
+/// <param name="t">Tile to render</param>
+/// <param name="world">Hittable objects</param>
+/// <param name="packed">packet_world of the world, null to trace camera rays one by one</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings</param>
+/// <param name="image">Framebuffer receiving the sample sums</param>
+inline void render_tile_pass(const tile& t, const hittable& world, const packed_sphere_bvh* packed, const material_table& materials,
+	const light_list& lights, const camera& cam, const render_settings& settings, framebuffer& image)
+{
+	RT_STAT(auto tile_start = std::chrono::steady_clock::now());
+
+	if (settings.method == integrator::wavefront)
+	{
+		render_tile_wavefront(t, world, materials, lights, cam, settings, image);
+	}
+	else if (packed)
+	{
+		render_tile_packets(t, *packed, world, materials, lights, cam, settings, image);
+	}
+	else
+	{
+		render_tile(t, world, materials, lights, cam, settings, image);
+	}
+
+	RT_STAT(thread_stats().add_tile(std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count()));
+}
+
+/// <summary>
+/// Render the whole image progressively: every pass hands all tiles to the
+/// thread pool and adds up to pass_samples samples to every pixel, until
+/// each pixel holds samples_per_pixel or, with adaptive sampling, has
+/// converged. Samples already in the framebuffer (from a checkpoint) are
+/// kept and built upon.
+/// </summary>
+/// <param name="world">Hittable objects</param>
+/// <param name="materials">Materials of the scene</param>
+/// <param name="lights">Lights and sky of the scene</param>
+/// <param name="cam">Camera</param>
+/// <param name="settings">Render settings</param>
+/// <param name="pool">Worker threads</param>
+/// <param name="image">Framebuffer receiving the sample sums</param>
+/// <param name="on_pass">Called after every pass, e.g. to checkpoint</param>
+/// <param name="on_tile">Called from the rendering thread after every pass over a tile, e.g. to preview it</param>
+inline void render(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings,
+	thread_pool& pool, framebuffer& image, const std::function<void(const framebuffer&)>& on_pass = nullptr,
+	const std::function<void(const tile&, const framebuffer&)>& on_tile = nullptr)
+{
+	auto tiles = make_tiles(settings);
+	const packed_sphere_bvh* packed = packet_world(world, settings);
+
+	while (true)
+	{
+		image.update_converged(settings);
+		if (!needs_samples(image, settings)) break;
+
+		pool.parallel_for(static_cast<int>(tiles.size()), [&](int index) {
+			render_tile_pass(tiles[index], world, packed, materials, lights, cam, settings, image);
+			if (on_tile) on_tile(tiles[index], image);
+		});
+
+		if (on_pass)
+		{
+			on_pass(image);
+		}
+	}
+}
+
+#endif // !RENDER_H
@@ -0,0 +1,116 @@
+#ifndef RENDER_SETTINGS_H
+#define RENDER_SETTINGS_H
+
+#include <algorithm>
+#include <vector>
+
+#include "rng.h"
+
+/// <summary>
+/// How the world is stored for intersection
+/// </summary>
+enum class accelerator
+{
+	list,       // Linear scan over hittable_list
+	bvh,        // bvh_node over the hittables
+	packed,     // Flat SoA spheres, intersected a vector at a time
+	packed_bvh  // BVH with SoA sphere leaves (falls back to bvh for non-sphere scenes)
+};
+
+/// <summary>
+/// How paths are traced
+/// </summary>
+enum class integrator
+{
+	recursive, // One path at a time through ray_color
+	wavefront  // Batches of paths advanced stage by stage, shaded per material type
+};
+
+/// <summary>
+/// What diffuse surfaces aim shadow rays at. Light found that way is
+/// weighed against light found by scattering (multiple importance sampling).
+/// </summary>
+enum class light_sampling_mode
+{
+	off,    // Light is only found by scattering into it
+	lights, // Emissive spheres
+	all     // Emissive spheres and the sky, sampled by its brightness
+};
+
+/// <summary>
+/// Image and sampling parameters for a render
+/// </summary>
+struct render_settings
+{
+	int width = 1200;
+	int height = 800;
+	int samples_per_pixel = 200;
+	int max_depth = 50;
+	int roulette_depth = 5; // Bounces before Russian roulette may end a path, max_depth or more disables it
+	int tile_size = 32;   // Edge length of a square tile in pixels
+	unsigned threads = 0; // 0 uses every hardware thread
+	accelerator accel = accelerator::packed_bvh;
+	integrator method = integrator::recursive;
+	int wavefront_batch = 1 << 14; // Paths in flight per tile for the wavefront integrator
+	int pass_samples = 16; // Samples added to every pixel per progressive pass, 0 for a single pass
+	int preview_samples = 0; // Samples of a coarse first pass, doubled every pass up to pass_samples, 0 starts with pass_samples
+	int packet_size = 8; // Camera rays traced as one packet through a sphere BVH (4, 8 or 16), 0 traces them one by one
+	double adaptive_threshold = 0.0; // Display error at which a pixel stops sampling, 0 samples every pixel fully
+	int min_samples = 16; // Samples every pixel gets before adaptive sampling may stop it
+	sampler_kind sampler = sampler_kind::sobol; // Source of the first numbers of every bounce
+	light_sampling_mode light_sampling = light_sampling_mode::lights; // Next-event estimation from diffuse surfaces
+};
+
+/// <summary>
+/// Generator for one sample of a pixel under the settings' sampler
+/// </summary>
+/// <param name="settings">Render settings</param>
+/// <param name="i">Pixel column</param>
+/// <param name="j">Pixel row</param>
+/// <param name="sample">Sample index within the pixel</param>
+/// <returns>Generator for the sample's path</returns>
+inline rng pixel_rng(const render_settings& settings, int i, int j, int sample)
+{
+	sample_pattern pattern;
+	pattern.kind = settings.sampler;
+	pattern.x = static_cast<uint32_t>(i);
+	pattern.y = static_cast<uint32_t>(j);
+	pattern.samples = static_cast<uint32_t>(std::max(1, settings.samples_per_pixel));
+
+	uint64_t pixel_index = static_cast<uint64_t>(j) * settings.width + i;
+	return rng(pixel_index, static_cast<uint32_t>(sample), pattern);
+}
+
+/// <summary>
+/// Rectangle of pixels [x0, x1) x [y0, y1) rendered as one unit of work
+/// </summary>
+struct tile
+{
+	int index;
+	int x0, y0;
+	int x1, y1;
+};
+
+/// <summary>
+/// Split the image into square tiles in row-major order
+/// </summary>
+/// <param name="settings">Render settings</param>
+/// <returns>Tiles covering the image</returns>
+inline std::vector<tile> make_tiles(const render_settings& settings)
+{
+	std::vector<tile> tiles;
+	int size = std::max(1, settings.tile_size);
+
+	for (int y = 0; y < settings.height; y += size)
+	{
+		for (int x = 0; x < settings.width; x += size)
+		{
+			tiles.push_back({ static_cast<int>(tiles.size()), x, y,
+				std::min(x + size, settings.width), std::min(y + size, settings.height) });
+		}
+	}
+
+	return tiles;
+}
+
+#endif // !RENDER_SETTINGS_H
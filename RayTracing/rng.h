@@ -0,0 +1,153 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+#include "sampler.h"
+
+/// <summary>
+/// Counter-based random number generator (Philox4x32-10).
+/// Every number is a pure function of (stream, sample, bounce, index), so
+/// there is no hidden global state: a pixel sample draws the same numbers
+/// on any thread, in any tile order, for any thread count.
+/// With a sample pattern, the first sampler_dimensions numbers of every
+/// bounce come from that low-discrepancy sampler instead.
+/// </summary>
+class rng
+{
+public:
+	/// <summary>
+	/// Create the generator for one sample of one stream
+	/// </summary>
+	/// <param name="stream">Stream id, the pixel index when rendering</param>
+	/// <param name="sample">Sample index within the stream</param>
+	/// <param name="seed">Global seed, changes every stream at once</param>
+	explicit rng(uint64_t stream = 0, uint32_t sample = 0, uint32_t seed = 0)
+		: key{ static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32) },
+		  sample(sample), seed(seed)
+	{}
+
+	/// <summary>
+	/// Create the generator for one sample of a pixel under a sampler
+	/// </summary>
+	/// <param name="stream">Stream id, the pixel index</param>
+	/// <param name="sample">Sample index within the pixel</param>
+	/// <param name="pattern">Sampler and pixel position</param>
+	/// <param name="seed">Global seed</param>
+	rng(uint64_t stream, uint32_t sample, const sample_pattern& pattern, uint32_t seed = 0)
+		: rng(stream, sample, seed)
+	{
+		this->pattern = pattern;
+		pixel_seed = sampler_detail::hash(sampler_detail::hash(key[0], key[1]), seed);
+	}
+
+	/// <summary>
+	/// Move on to the next bounce of the path. Numbers drawn at a bounce do
+	/// not depend on how many were drawn by earlier bounces.
+	/// </summary>
+	void next_bounce()
+	{
+		bounce++;
+		block = 0;
+		available = 0;
+		dimension = 0;
+	}
+
+	/// <summary>
+	/// Restart the sequence at a given bounce
+	/// </summary>
+	/// <param name="b">Bounce index, 0 for the camera ray</param>
+	void set_bounce(uint32_t b)
+	{
+		bounce = b;
+		block = 0;
+		available = 0;
+		dimension = 0;
+	}
+
+	uint32_t current_bounce() const { return bounce; }
+
+	/// <summary>
+	/// Next 64 random bits
+	/// </summary>
+	uint64_t next_u64()
+	{
+		if (available == 0)
+		{
+			uint32_t counter[4] = { block++, bounce, sample, seed };
+			philox(counter, output);
+			available = 2;
+		}
+
+		int base = 2 * (2 - available--);
+		return (static_cast<uint64_t>(output[base]) << 32) | output[base + 1];
+	}
+
+	/// <summary>
+	/// Uniform double in [0, 1) with the full 53 bits of mantissa
+	/// </summary>
+	double next_double()
+	{
+		if (pattern.kind != sampler_kind::independent && dimension < sampler_dimensions)
+		{
+			// Samplers make their numbers in pairs
+			if ((dimension & 1) == 0)
+			{
+				sample_pair(pattern, pixel_seed, sample, bounce, dimension / 2, pair);
+			}
+			return pair[dimension++ & 1];
+		}
+
+		return static_cast<double>(next_u64() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/// <summary>
+	/// Evaluate Philox4x32-10 for a counter under this generator's key
+	/// </summary>
+	/// <param name="counter">128-bit counter</param>
+	/// <param name="result">128 random bits</param>
+	void philox(const uint32_t counter[4], uint32_t result[4]) const
+	{
+		uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int round = 0; round < 10; ++round)
+		{
+			uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+			uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+
+			uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+			uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+
+			c0 = hi1 ^ c1 ^ k0;
+			c1 = lo1;
+			c2 = hi0 ^ c3 ^ k1;
+			c3 = lo0;
+
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+
+		result[0] = c0;
+		result[1] = c1;
+		result[2] = c2;
+		result[3] = c3;
+	}
+
+private:
+	uint32_t key[2];
+	uint32_t sample;
+	uint32_t seed;
+	uint32_t bounce = 0;
+	uint32_t block = 0;
+
+	uint32_t output[4] = {};
+	int available = 0; // 64-bit values left in output
+
+	sample_pattern pattern;
+	uint32_t pixel_seed = 0;
+	uint32_t dimension = 0; // Sampler dimensions used in this bounce
+	double pair[2] = {};
+};
+
+#endif // !RNG_H
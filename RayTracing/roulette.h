@@ -0,0 +1,30 @@
+#ifndef ROULETTE_H
+#define ROULETTE_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+/// <summary>
+/// Russian roulette: once a path has made min_depth bounces, end it with a
+/// probability that grows as its throughput falls. Surviving paths are
+/// divided by their survival probability, so the estimate stays unbiased
+/// while dim paths stop early instead of bouncing to the depth limit.
+/// </summary>
+/// <param name="throughput">Product of the attenuations so far, reweighted if the path survives</param>
+/// <param name="bounces">Bounces the path has made</param>
+/// <param name="min_depth">Bounces before roulette starts</param>
+/// <param name="gen">Random number generator for this path</param>
+/// <returns>False if the path is terminated</returns>
+inline bool russian_roulette(color& throughput, int bounces, int min_depth, rng& gen)
+{
+	if (bounces < min_depth) return true;
+
+	real survive = std::min(static_cast<real>(0.95), std::max({ throughput.x(), throughput.y(), throughput.z() }));
+	if (random_double(gen) >= survive) return false;
+
+	throughput = throughput / survive;
+	return true;
+}
+
+#endif // !ROULETTE_H
@@ -6,14 +6,17 @@
 #include <limits>
 #include <memory>
 
+#include "precision.h"
+#include "rng.h"
+
 // Usings
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = static_cast<real>(3.1415926535897932385);
 
 // Utility Functions
 
@@ -22,29 +25,31 @@ const double pi = 3.1415926535897932385;
 /// </summary>
 /// <param name="degrees">Angle in degrees</param>
 /// <returns>Angle in radians</returns>
-inline double degrees_to_radians(double degrees)
+inline real degrees_to_radians(real degrees)
 {
-    return degrees * pi / 180.0;
+    return degrees * pi / real(180);
 }
 
 /// <summary>
 /// Generate a random double in [0, 1]
 /// </summary>
+/// <param name="gen">Random number generator</param>
 /// <returns></returns>
-inline double random_double()
+inline double random_double(rng& gen)
 {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return gen.next_double();
 }
 
 /// <summary>
 /// Generate a random double in [min, max]
 /// </summary>
+/// <param name="gen">Random number generator</param>
 /// <returns></returns>
-inline double random_double(double min, double max)
+inline double random_double(double min, double max, rng& gen)
 {
     // Returns a random real in [min,max).
-    return min + (max - min) * random_double();
+    return min + (max - min) * random_double(gen);
 }
 
 /// <summary>
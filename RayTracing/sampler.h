@@ -0,0 +1,265 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/// <summary>
+/// Where the first numbers of every bounce come from. The camera ray uses
+/// dimensions 0-1 of bounce 0 for the pixel jitter and 2-3 for the lens;
+/// a scattering bounce uses its first dimensions for the material and the
+/// next one for Russian roulette. Numbers past sampler_dimensions in a
+/// bounce always come from Philox.
+/// </summary>
+enum class sampler_kind
+{
+	independent, // Philox only
+	stratified,  // Jittered grid of samples_per_pixel cells per dimension pair, shuffled per pixel
+	sobol,       // Owen-scrambled Sobol (0,2)-sequence per dimension pair, shuffled per pixel
+	halton,      // Owen-scrambled Halton, one prime per dimension, Sobol pairs past the primes
+	blue_noise   // One Owen-scrambled Sobol sequence for all pixels, rotated per pixel by a screen-space dither
+};
+
+/// <summary>
+/// Low-discrepancy numbers drawn per bounce before Philox takes over
+/// </summary>
+const uint32_t sampler_dimensions = 4;
+
+/// <summary>
+/// How the samples of one pixel are drawn
+/// </summary>
+struct sample_pattern
+{
+	sampler_kind kind = sampler_kind::independent;
+	uint32_t x = 0, y = 0;  // Pixel, for the blue-noise dither
+	uint32_t samples = 1;   // Samples per pixel, the stratified grid's size
+};
+
+namespace sampler_detail
+{
+	/// <summary>
+	/// 32-bit integer hash (lowbias32)
+	/// </summary>
+	inline uint32_t hash(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t hash(uint32_t a, uint32_t b) { return hash(a ^ hash(b + 0x9E3779B9u)); }
+
+	inline uint32_t reverse_bits(uint32_t x)
+	{
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+		x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	/// <summary>
+	/// Map 32 bits to [0, 1)
+	/// </summary>
+	inline double to_unit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+	/// <summary>
+	/// Base-2 Owen scrambling of a bit-reversed 32-bit fraction: every bit
+	/// is flipped depending on the bits below it, which are the ones above
+	/// it in the fraction (Laine-Karras hash, Burley's constants)
+	/// </summary>
+	inline uint32_t laine_karras(uint32_t x, uint32_t seed)
+	{
+		x ^= x * 0x3d20adeau;
+		x += seed;
+		x *= (seed >> 16) | 1u;
+		x ^= x * 0x05526c56u;
+		x ^= x * 0x53a22864u;
+		return x;
+	}
+
+	/// <summary>
+	/// Base-2 Owen scrambling of a 32-bit fraction
+	/// </summary>
+	inline uint32_t owen_scramble(uint32_t x, uint32_t seed)
+	{
+		return reverse_bits(laine_karras(reverse_bits(x), seed));
+	}
+
+	/// <summary>
+	/// Random permutation of [0, length) indexed by seed (Kensler)
+	/// </summary>
+	inline uint32_t permute(uint32_t i, uint32_t length, uint32_t seed)
+	{
+		uint32_t w = length - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+
+		do
+		{
+			i ^= seed;
+			i *= 0xe170893du;
+			i ^= seed >> 16;
+			i ^= (i & w) >> 4;
+			i ^= seed >> 8;
+			i *= 0x0929eb3fu;
+			i ^= seed >> 23;
+			i ^= (i & w) >> 1;
+			i *= 1u | seed >> 27;
+			i *= 0x6935fa69u;
+			i ^= (i & w) >> 11;
+			i *= 0x74dcb303u;
+			i ^= (i & w) >> 2;
+			i *= 0x9e501cc3u;
+			i ^= (i & w) >> 2;
+			i *= 0xc860a3dfu;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= length);
+
+		return (i + seed) % length;
+	}
+
+	/// <summary>
+	/// Owen-scrambled 2D Sobol point with the index shuffled too, so that
+	/// pairs with different seeds are independent (Burley 2020).
+	/// The first dimension is the van der Corput sequence, the index with
+	/// its bits reversed. The second has primitive polynomial x + 1 and
+	/// Pascal's triangle mod 2 as its generator matrix: bit j of its
+	/// reversed value is the parity of the index bits i that contain j, a
+	/// superset sum done in five steps. Both are scrambled while still
+	/// bit-reversed, so each costs one reversal.
+	/// </summary>
+	inline void owen_sobol(uint32_t index, uint32_t seed, double out[2])
+	{
+		seed = hash(seed);
+		index = owen_scramble(index, seed);
+
+		uint32_t pascal = index;
+		pascal ^= (pascal >> 1) & 0x55555555u;
+		pascal ^= (pascal >> 2) & 0x33333333u;
+		pascal ^= (pascal >> 4) & 0x0F0F0F0Fu;
+		pascal ^= (pascal >> 8) & 0x00FF00FFu;
+		pascal ^= (pascal >> 16) & 0x0000FFFFu;
+
+		out[0] = to_unit(reverse_bits(laine_karras(index, seed * 0x9E3779B9u + 1u)));
+		out[1] = to_unit(reverse_bits(laine_karras(pascal, seed * 0x85EBCA6Bu + 2u)));
+	}
+
+	/// <summary>
+	/// Owen-scrambled radical inverse in an odd prime base: each digit is
+	/// permuted by a permutation picked from the digits before it. Once the
+	/// index has no digits left, the scrambled zeros that follow are
+	/// uniformly random, so they are drawn as one number.
+	/// </summary>
+	inline double owen_halton(uint32_t index, uint32_t base, uint32_t seed)
+	{
+		const double inv_base = 1.0 / base;
+		double scale = inv_base;
+		double result = 0.0;
+		uint32_t prefix = 0;
+
+		for (; index; index /= base)
+		{
+			uint32_t digit = index % base;
+
+			result += permute(digit, base, hash(seed, prefix)) * scale;
+			prefix = hash(prefix, digit + 1);
+			scale *= inv_base;
+		}
+
+		result += to_unit(hash(seed, prefix)) * scale * base;
+		return std::min(result, 0x1.fffffffffffffp-1);
+	}
+
+	/// <summary>
+	/// Odd primes for the Halton dimensions, dimension 0 is base 2
+	/// </summary>
+	const uint32_t halton_primes[] = {
+		3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59,
+		61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+	};
+
+	const uint32_t halton_dimensions = 1 + sizeof(halton_primes) / sizeof(halton_primes[0]);
+
+	/// <summary>
+	/// Per-pixel dither from the R2 sequence over the screen: neighbouring
+	/// pixels get well spread offsets, so their errors cancel and what
+	/// remains is high-frequency (blue) noise, without a precomputed mask
+	/// </summary>
+	inline double screen_dither(uint32_t x, uint32_t y, uint32_t axis)
+	{
+		const double a1 = 0.7548776662466927, a2 = 0.5698402909980532;
+		double v = axis == 0 ? 0.5 + a1 * x + a2 * y : 0.5 + a2 * x + a1 * y;
+		return v - std::floor(v);
+	}
+}
+
+/// <summary>
+/// Two low-discrepancy numbers of a sample, dimensions 2 * pair and
+/// 2 * pair + 1 of a bounce
+/// </summary>
+/// <param name="pattern">Sampler and pixel</param>
+/// <param name="pixel_seed">Hash of the pixel and the global seed</param>
+/// <param name="sample">Sample index within the pixel</param>
+/// <param name="bounce">Bounce of the path</param>
+/// <param name="pair">Dimension pair within the bounce, below sampler_dimensions / 2</param>
+/// <param name="out">Numbers in [0, 1)</param>
+inline void sample_pair(const sample_pattern& pattern, uint32_t pixel_seed, uint32_t sample, uint32_t bounce, uint32_t pair, double out[2])
+{
+	using namespace sampler_detail;
+
+	pair += bounce * (sampler_dimensions / 2);
+
+	switch (pattern.kind)
+	{
+		case sampler_kind::stratified:
+		{
+			uint32_t n = std::max(1u, pattern.samples);
+			uint32_t nx = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(n))));
+			uint32_t ny = (n + nx - 1) / nx;
+
+			uint32_t seed = hash(pixel_seed, pair);
+			uint32_t cell = permute(sample % (nx * ny), nx * ny, seed);
+
+			out[0] = (cell % nx + to_unit(hash(seed, sample * 2))) / nx;
+			out[1] = (cell / nx + to_unit(hash(seed, sample * 2 + 1))) / ny;
+			return;
+		}
+		case sampler_kind::halton:
+		{
+			uint32_t d = 2 * pair;
+			if (d + 1 >= halton_dimensions) break;
+
+			uint32_t seed = hash(pixel_seed, d);
+			out[0] = d == 0 ? to_unit(owen_scramble(reverse_bits(sample), seed)) : owen_halton(sample, halton_primes[d - 1], seed);
+			out[1] = owen_halton(sample, halton_primes[d], hash(pixel_seed, d + 1));
+			return;
+		}
+		case sampler_kind::blue_noise:
+		{
+			owen_sobol(sample, hash(0xB1E5EEDu, pair), out);
+			for (uint32_t axis = 0; axis < 2; ++axis)
+			{
+				double v = out[axis] + screen_dither(pattern.x, pattern.y, axis);
+				out[axis] = v < 1.0 ? v : v - 1.0;
+			}
+			return;
+		}
+		case sampler_kind::sobol:
+		case sampler_kind::independent:
+			break;
+	}
+
+	// Sobol, and padding for Halton past its primes
+	owen_sobol(sample, hash(pixel_seed, pair), out);
+}
+
+#endif // !SAMPLER_H
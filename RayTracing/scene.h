@@ -0,0 +1,494 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "lights.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "packed_spheres.h"
+#include "render_settings.h"
+#include "sphere.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/// <summary>
+/// Parameters the camera is built from, kept so scenes can be saved
+/// </summary>
+struct camera_settings
+{
+	point3 lookfrom = point3(13.0, 2.0, 3.0);
+	point3 lookat = point3(0.0, 0.0, 0.0);
+	vec3 up = vec3(0.0, 1.0, 0.0);
+	double vfov = 20.0;
+	double aspect = 3.0 / 2.0;
+	double aperture = 0.1;
+	double focus_distance = 10.0;
+
+	camera make_camera() const
+	{
+		return camera(lookfrom, lookat, up, vfov, aspect, aperture, focus_distance);
+	}
+};
+
+/// <summary>
+/// Everything a render needs besides its settings
+/// </summary>
+struct scene
+{
+	material_table materials;
+	packed_spheres spheres; // Top-level spheres, stored flat
+	hittable_list world;    // Every other top-level object
+	camera_settings view;
+	environment sky;
+
+	// Spheres and BVH taken ready-built from a scene cache, world is empty then
+	shared_ptr<packed_sphere_bvh> prebuilt;
+};
+
+/// <summary>
+/// Every object as one list, the spheres first
+/// </summary>
+/// <param name="spheres">Flat spheres</param>
+/// <param name="objects">Other objects</param>
+/// <returns>List holding both</returns>
+inline hittable_list combine(const packed_spheres& spheres, const hittable_list& objects)
+{
+	hittable_list all;
+	spheres.to_list(all);
+	for (const auto& object : objects.objects)
+	{
+		all.add(object);
+	}
+
+	return all;
+}
+
+/// <summary>
+/// Bottom-level acceleration structure for geometry shared by instances:
+/// packed spheres when the geometry is only spheres, a BVH otherwise
+/// </summary>
+/// <param name="spheres">Spheres of a group</param>
+/// <param name="objects">Other geometry of the group</param>
+/// <returns>Hittable holding the geometry in object space</returns>
+inline shared_ptr<hittable> build_bottom_level(const packed_spheres& spheres, const hittable_list& objects)
+{
+	if (objects.objects.empty())
+	{
+		return make_shared<packed_sphere_bvh>(spheres);
+	}
+
+	return make_shared<bvh_node>(combine(spheres, objects));
+}
+
+/// <summary>
+/// Wrap the world in the requested acceleration structure
+/// </summary>
+/// <param name="s">Scene</param>
+/// <param name="accel">Requested storage</param>
+/// <returns>Hittable to render</returns>
+inline shared_ptr<hittable> build_accelerator(const scene& s, accelerator accel)
+{
+	// A scene cache already holds the packed BVH, and nothing else
+	if (s.prebuilt && accel == accelerator::packed_bvh) return s.prebuilt;
+	const packed_spheres& spheres = s.prebuilt ? s.prebuilt->spheres : s.spheres;
+
+	if (accel == accelerator::packed || accel == accelerator::packed_bvh)
+	{
+		if (s.world.objects.empty())
+		{
+			if (accel == accelerator::packed)
+			{
+				return make_shared<packed_spheres>(spheres);
+			}
+
+			return make_shared<packed_sphere_bvh>(spheres);
+		}
+
+		// Not a sphere-only scene
+		accel = accelerator::bvh;
+	}
+
+	hittable_list world = combine(spheres, s.world);
+
+	if (accel == accelerator::bvh)
+	{
+		return make_shared<bvh_node>(world);
+	}
+
+	return make_shared<hittable_list>(world);
+}
+
+/// <summary>
+/// Number of primitives in a scene: spheres, mesh triangles, and one for
+/// every other object
+/// </summary>
+inline size_t primitive_count(const scene& s)
+{
+	size_t count = s.spheres.size() + (s.prebuilt ? s.prebuilt->spheres.size() : 0);
+	for (const auto& object : s.world.objects)
+	{
+		auto mesh = dynamic_cast<const triangle_mesh*>(object.get());
+		count += mesh ? mesh->triangle_count() : 1;
+	}
+
+	return count;
+}
+
+/// <summary>
+/// Bytes of a scene's storage: materials, flat spheres, other objects,
+/// the prebuilt BVH of a scene cache, and once each, the geometry that
+/// instances place
+/// </summary>
+inline size_t scene_storage_bytes(const scene& s)
+{
+	size_t bytes = s.materials.storage_bytes() + s.spheres.storage_bytes() + s.world.memory_bytes();
+	if (s.prebuilt) bytes += s.prebuilt->memory_bytes();
+
+	std::unordered_set<const hittable*> placed;
+	for (const auto& object : s.world.objects)
+	{
+		auto inst = dynamic_cast<const instance*>(object.get());
+		if (inst && placed.insert(inst->geometry.get()).second) bytes += inst->geometry->memory_bytes();
+	}
+
+	return bytes;
+}
+
+/// <summary>
+/// Bytes an accelerator adds to its scene's storage
+/// </summary>
+/// <param name="accel">Accelerator built by build_accelerator</param>
+/// <param name="s">Scene it was built from</param>
+inline size_t accelerator_bytes(const hittable& accel, const scene& s)
+{
+	// A scene cache's BVH is the scene's storage
+	if (&accel == s.prebuilt.get()) return 0;
+
+	size_t bytes = accel.memory_bytes();
+
+	// A list or BVH over objects holds the scene's other objects, not copies
+	if (!dynamic_cast<const packed_spheres*>(&accel) && !dynamic_cast<const packed_sphere_bvh*>(&accel))
+	{
+		for (const auto& object : s.world.objects)
+		{
+			bytes -= object->memory_bytes();
+		}
+	}
+
+	return bytes;
+}
+
+/// <summary>
+/// Collect the scene's lights: every top-level sphere, or sphere of the
+/// prebuilt BVH, whose material emits, and the sky. Emissive objects
+/// inside instances or meshes still give light when paths hit them but
+/// are not aimed at, and so are spheres with a negative radius: turned
+/// inside out, they only light their inside, which a cone toward them
+/// cannot sample.
+/// </summary>
+/// <param name="s">Scene</param>
+/// <param name="mode">What to aim at</param>
+/// <returns>Lights ready to sample</returns>
+inline light_list make_lights(const scene& s, light_sampling_mode mode)
+{
+	light_list lights;
+	lights.sky = s.sky;
+
+	auto add = [&](const point3& center, real radius, material_id m, const vec3& velocity) {
+		const material& mat = s.materials[m];
+		if (mat.kind() == material_kind::diffuse_light && radius > 0)
+		{
+			lights.spheres.push_back({ center, velocity, radius, mat.as<diffuse_light>().emit });
+		}
+	};
+
+	const packed_spheres& spheres = s.prebuilt ? s.prebuilt->spheres : s.spheres;
+	for (size_t i = 0; i < spheres.size(); ++i)
+	{
+		add(spheres.center(i), spheres.radius[i], spheres.mat_id[i], spheres.velocity(i));
+	}
+
+	lights.build(mode != light_sampling_mode::off, mode == light_sampling_mode::all);
+	return lights;
+}
+
+namespace scene_detail
+{
+	inline bool read(std::istringstream& in, double& v) { return static_cast<bool>(in >> v); }
+	inline bool read(std::istringstream& in, int& v) { return static_cast<bool>(in >> v); }
+
+	/// <summary>
+	/// Resolve a path written in a scene file against the scene's directory
+	/// </summary>
+	inline std::string relative_to(const std::string& scene_path, const std::string& path)
+	{
+		bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+		auto slash = scene_path.find_last_of("/\\");
+		if (absolute || slash == std::string::npos) return path;
+
+		return scene_path.substr(0, slash + 1) + path;
+	}
+
+	inline bool read(std::istringstream& in, vec3& v)
+	{
+		double x, y, z;
+		if (!(in >> x >> y >> z)) return false;
+		v = vec3(x, y, z);
+		return true;
+	}
+}
+
+/// <summary>
+/// Load a text scene. One statement per line, # starts a comment:
+///
+///   render width 1200 samples 200 max_depth 50
+///   camera lookfrom 13 2 3 lookat 0 0 0 up 0 1 0 vfov 20 aspect 1.5 aperture 0.1 focus_distance 10
+///   material ground lambertian 0.5 0.5 0.5
+///   material steel metal 0.7 0.6 0.5 0.1
+///   material glass dielectric 1.5
+///   material lamp light 4 4 4
+///   sky 1 1 1 0.5 0.7 1
+///   sphere 0 -1000 0 1000 ground
+///   sphere 2 0.5 1 0.5 steel velocity 0 0 -1
+///   mesh bunny.obj steel
+///   group cluster
+///     sphere 0 0 0 0.2 steel
+///     sphere 0.5 0 0 0.2 glass
+///   end
+///   instance cluster scale 2 2 2 rotate 0 1 0 45 translate 3 0 -2
+///
+/// render takes any of width, samples, min_samples, adaptive_threshold,
+/// max_depth and roulette_depth; camera keys left out keep their defaults.
+/// A light material emits its color from the outside of what it covers.
+/// sky gives the colors straight down and straight up, 0 0 0 0 0 0 turns
+/// it off for interiors.
+/// Materials must be declared before the objects that use them. Mesh
+/// paths are relative to the scene file. A sphere's velocity, in units per
+/// second, moves it when frames are rendered at later times and blurs it
+/// while the shutter is open.
+/// A group's objects are built into their own BVH once and can be placed
+/// any number of times by instance, whose translate, rotate (axis and
+/// degrees) and scale steps apply to the group in the order written.
+/// </summary>
+/// <param name="path">Scene file</param>
+/// <param name="out">Scene to fill</param>
+/// <param name="settings">Render settings the scene's render line updates</param>
+/// <returns>False if the file could not be read or has an error, which is printed</returns>
+inline bool load_scene_text(const std::string& path, scene& out, render_settings& settings)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Could not open scene " << path << std::endl;
+		return false;
+	}
+
+	std::unordered_map<std::string, material_id> material_names;
+	std::unordered_map<std::string, shared_ptr<hittable>> groups;
+
+	// Objects go to the world, or to the group being defined
+	packed_spheres group_spheres;
+	hittable_list group_objects;
+	std::string group_name;
+	packed_spheres* sphere_target = &out.spheres;
+	hittable_list* target = &out.world;
+
+	std::string line;
+	int line_number = 0;
+
+	auto fail = [&](const std::string& message) {
+		std::cerr << path << ":" << line_number << ": " << message << std::endl;
+		return false;
+	};
+
+	while (std::getline(file, line))
+	{
+		line_number++;
+
+		auto comment = line.find('#');
+		if (comment != std::string::npos) line.erase(comment);
+
+		std::istringstream in(line);
+		std::string statement;
+		if (!(in >> statement)) continue;
+
+		if (statement == "sphere")
+		{
+			vec3 center;
+			double radius;
+			std::string name;
+			if (!scene_detail::read(in, center) || !scene_detail::read(in, radius) || !(in >> name))
+			{
+				return fail("expected: sphere x y z radius material [velocity x y z]");
+			}
+
+			auto found = material_names.find(name);
+			if (found == material_names.end()) return fail("unknown material " + name);
+
+			vec3 velocity(0.0, 0.0, 0.0);
+			std::string key;
+			if (in >> key && (key != "velocity" || !scene_detail::read(in, velocity)))
+			{
+				return fail("bad sphere option " + key);
+			}
+
+			sphere_target->add(center, radius, found->second, velocity);
+		}
+		else if (statement == "mesh")
+		{
+			std::string file_name, name;
+			if (!(in >> file_name >> name)) return fail("expected: mesh file.obj material");
+
+			auto found = material_names.find(name);
+			if (found == material_names.end()) return fail("unknown material " + name);
+
+			auto mesh = make_shared<triangle_mesh>();
+			mesh->mat_id = found->second;
+			if (!load_obj(scene_detail::relative_to(path, file_name), *mesh)) return fail("could not load mesh " + file_name);
+
+			target->add(mesh);
+		}
+		else if (statement == "group")
+		{
+			if (!group_name.empty()) return fail("groups cannot be nested");
+			if (!(in >> group_name)) return fail("expected: group name");
+
+			group_spheres = packed_spheres();
+			group_objects.clear();
+			sphere_target = &group_spheres;
+			target = &group_objects;
+		}
+		else if (statement == "end")
+		{
+			if (group_name.empty()) return fail("end without group");
+			if (group_spheres.size() == 0 && group_objects.objects.empty()) return fail("group " + group_name + " is empty");
+
+			groups[group_name] = build_bottom_level(group_spheres, group_objects);
+			group_name.clear();
+			sphere_target = &out.spheres;
+			target = &out.world;
+		}
+		else if (statement == "instance")
+		{
+			std::string name;
+			if (!(in >> name)) return fail("expected: instance group transforms");
+
+			auto found = groups.find(name);
+			if (found == groups.end()) return fail("unknown group " + name);
+
+			affine_transform transform;
+			std::string step;
+			while (in >> step)
+			{
+				vec3 v;
+				double degrees;
+
+				if (step == "translate" && scene_detail::read(in, v))
+				{
+					transform = affine_transform::translate(v) * transform;
+				}
+				else if (step == "scale" && scene_detail::read(in, v))
+				{
+					transform = affine_transform::scale(v) * transform;
+				}
+				else if (step == "rotate" && scene_detail::read(in, v) && scene_detail::read(in, degrees))
+				{
+					transform = affine_transform::rotate(v, degrees) * transform;
+				}
+				else
+				{
+					return fail("bad instance transform " + step);
+				}
+			}
+
+			target->add(make_shared<instance>(found->second, transform));
+		}
+		else if (statement == "material")
+		{
+			std::string name, type;
+			if (!(in >> name >> type)) return fail("expected: material name type parameters");
+
+			color albedo;
+			double value;
+
+			if (type == "lambertian" && scene_detail::read(in, albedo))
+			{
+				material_names[name] = out.materials.add(lambertian(albedo));
+			}
+			else if (type == "metal" && scene_detail::read(in, albedo) && scene_detail::read(in, value))
+			{
+				material_names[name] = out.materials.add(metal(albedo, value));
+			}
+			else if (type == "dielectric" && scene_detail::read(in, value))
+			{
+				material_names[name] = out.materials.add(dielectric(value));
+			}
+			else if (type == "light" && scene_detail::read(in, albedo))
+			{
+				material_names[name] = out.materials.add(diffuse_light(albedo));
+			}
+			else
+			{
+				return fail("bad material " + name);
+			}
+		}
+		else if (statement == "sky")
+		{
+			if (!scene_detail::read(in, out.sky.nadir) || !scene_detail::read(in, out.sky.zenith))
+			{
+				return fail("expected: sky r g b r g b");
+			}
+		}
+		else if (statement == "camera" || statement == "render")
+		{
+			std::string key;
+			while (in >> key)
+			{
+				bool ok = false;
+
+				if (statement == "camera")
+				{
+					camera_settings& c = out.view;
+					if (key == "lookfrom") ok = scene_detail::read(in, c.lookfrom);
+					else if (key == "lookat") ok = scene_detail::read(in, c.lookat);
+					else if (key == "up") ok = scene_detail::read(in, c.up);
+					else if (key == "vfov") ok = scene_detail::read(in, c.vfov);
+					else if (key == "aspect") ok = scene_detail::read(in, c.aspect);
+					else if (key == "aperture") ok = scene_detail::read(in, c.aperture);
+					else if (key == "focus_distance") ok = scene_detail::read(in, c.focus_distance);
+				}
+				else
+				{
+					if (key == "width") ok = scene_detail::read(in, settings.width);
+					else if (key == "samples") ok = scene_detail::read(in, settings.samples_per_pixel);
+					else if (key == "min_samples") ok = scene_detail::read(in, settings.min_samples);
+					else if (key == "adaptive_threshold") ok = scene_detail::read(in, settings.adaptive_threshold);
+					else if (key == "max_depth") ok = scene_detail::read(in, settings.max_depth);
+					else if (key == "roulette_depth") ok = scene_detail::read(in, settings.roulette_depth);
+				}
+
+				if (!ok) return fail("bad " + statement + " value for " + key);
+			}
+		}
+		else
+		{
+			return fail("unknown statement " + statement);
+		}
+	}
+
+	if (!group_name.empty()) return fail("group " + group_name + " has no end");
+
+	return true;
+}
+
+#endif // !SCENE_H
@@ -0,0 +1,367 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "mapped_file.h"
+#include "scene.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Start of a binary scene cache. The cache holds the scene with its
+/// spheres already packed and sorted into BVH leaf order, followed by the
+/// flattened BVH nodes, so loading is a handful of bulk copies out of a
+/// mapped file: no parsing, no per-object allocation and no BVH build.
+/// Every array starts on a 64-byte boundary. Values are in host byte order,
+/// and spheres and nodes are stored in the layout of the build that wrote
+/// them (see precision.h and vec3.h).
+/// </summary>
+struct scene_cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t material_count;
+	uint64_t sphere_count;
+	uint64_t node_count;
+
+	int32_t width;
+	int32_t samples_per_pixel;
+	int32_t min_samples;
+	int32_t max_depth;
+	int32_t roulette_depth;
+	int32_t real_size; // sizeof(real) of the build that wrote the cache
+	int32_t node_size; // sizeof(bvh_flat_node), which differs with RT_SIMD_VEC3
+	int32_t reserved;
+	double adaptive_threshold;
+
+	double lookfrom[3];
+	double lookat[3];
+	double up[3];
+	double vfov;
+	double aspect;
+	double aperture;
+	double focus_distance;
+	double sky_nadir[3];
+	double sky_zenith[3];
+};
+
+/// <summary>
+/// A material in the cache: its kind and up to four parameters
+/// (albedo and fuzz for metal, albedo for lambertian, index of refraction
+/// for dielectric, emitted color for a light)
+/// </summary>
+struct scene_cache_material
+{
+	uint32_t kind;
+	uint32_t reserved;
+	double params[4];
+};
+
+static_assert(std::is_trivially_copyable<bvh_flat_node>::value, "BVH nodes are copied straight out of the cache");
+
+namespace scene_cache_detail
+{
+	static constexpr const char* magic = "RTSCENE\0";
+	static const uint32_t version = 3;
+
+	// Offset of an array that does not fit in memory
+	const size_t overflow = ~size_t(0);
+
+	inline size_t align(size_t offset) { return offset == overflow ? overflow : (offset + 63) & ~size_t(63); }
+
+	/// <summary>
+	/// Offset after count elements of a given size, or overflow if it, or
+	/// it aligned, cannot be represented. Counts come from a file, so they
+	/// are not trusted to keep the sum in range.
+	/// </summary>
+	inline size_t after(size_t offset, uint64_t count, size_t size)
+	{
+		if (offset == overflow || count > (overflow - 63 - offset) / size) return overflow;
+		return offset + static_cast<size_t>(count) * size;
+	}
+
+	/// <summary>
+	/// Byte offsets of the arrays that follow the header. end is overflow
+	/// if the counts describe more bytes than a size_t can hold.
+	/// </summary>
+	struct layout
+	{
+		size_t materials, nodes, center_x, center_y, center_z, radius, mat_id, end;
+
+		layout(uint64_t material_count, uint64_t node_count, uint64_t sphere_count)
+		{
+			materials = align(sizeof(scene_cache_header));
+			nodes = align(after(materials, material_count, sizeof(scene_cache_material)));
+			center_x = align(after(nodes, node_count, sizeof(bvh_flat_node)));
+			center_y = align(after(center_x, sphere_count, sizeof(real)));
+			center_z = align(after(center_y, sphere_count, sizeof(real)));
+			radius = align(after(center_z, sphere_count, sizeof(real)));
+			mat_id = align(after(radius, sphere_count, sizeof(real)));
+			end = after(mat_id, sphere_count, sizeof(material_id));
+		}
+	};
+
+	inline void put_vec3(double out[3], const vec3& v)
+	{
+		out[0] = v.x();
+		out[1] = v.y();
+		out[2] = v.z();
+	}
+
+	inline vec3 get_vec3(const double in[3]) { return vec3(in[0], in[1], in[2]); }
+}
+
+/// <summary>
+/// Write a scene as a binary cache. Sphere-only scenes are supported; the
+/// BVH is built here unless the scene already carries one.
+/// </summary>
+/// <param name="path">Cache file to write</param>
+/// <param name="s">Scene</param>
+/// <param name="settings">Render settings stored with the scene</param>
+/// <returns>False if the scene holds other objects than spheres or the file could not be written</returns>
+inline bool save_scene_cache(const std::string& path, const scene& s, const render_settings& settings)
+{
+	using namespace scene_cache_detail;
+
+	shared_ptr<packed_sphere_bvh> accel = s.prebuilt;
+	if (!accel)
+	{
+		if (!s.world.objects.empty())
+		{
+			std::cerr << "Only scenes made of spheres can be cached" << std::endl;
+			return false;
+		}
+
+		if (s.spheres.moving())
+		{
+			std::cerr << "Scenes with moving spheres cannot be cached" << std::endl;
+			return false;
+		}
+
+		accel = make_shared<packed_sphere_bvh>(s.spheres);
+	}
+
+	const packed_spheres& spheres = accel->spheres;
+	const std::vector<bvh_flat_node>& nodes = accel->tree.nodes;
+
+	scene_cache_header header = {};
+	std::memcpy(header.magic, magic, sizeof(header.magic));
+	header.version = version;
+	header.material_count = static_cast<uint32_t>(s.materials.size());
+	header.sphere_count = spheres.size();
+	header.node_count = nodes.size();
+
+	header.width = settings.width;
+	header.samples_per_pixel = settings.samples_per_pixel;
+	header.min_samples = settings.min_samples;
+	header.max_depth = settings.max_depth;
+	header.roulette_depth = settings.roulette_depth;
+	header.real_size = static_cast<int32_t>(sizeof(real));
+	header.node_size = static_cast<int32_t>(sizeof(bvh_flat_node));
+	header.adaptive_threshold = settings.adaptive_threshold;
+
+	put_vec3(header.lookfrom, s.view.lookfrom);
+	put_vec3(header.lookat, s.view.lookat);
+	put_vec3(header.up, s.view.up);
+	header.vfov = s.view.vfov;
+	header.aspect = s.view.aspect;
+	header.aperture = s.view.aperture;
+	header.focus_distance = s.view.focus_distance;
+	put_vec3(header.sky_nadir, s.sky.nadir);
+	put_vec3(header.sky_zenith, s.sky.zenith);
+
+	layout at(header.material_count, header.node_count, header.sphere_count);
+	std::vector<unsigned char> bytes(at.end, 0);
+	std::memcpy(&bytes[0], &header, sizeof(header));
+
+	for (size_t i = 0; i < s.materials.size(); ++i)
+	{
+		const material& m = s.materials[static_cast<material_id>(i)];
+
+		scene_cache_material record = {};
+		record.kind = static_cast<uint32_t>(m.kind());
+
+		switch (m.kind())
+		{
+			case material_kind::lambertian:
+				put_vec3(record.params, m.as<lambertian>().albedo);
+				break;
+			case material_kind::metal:
+				put_vec3(record.params, m.as<metal>().albedo);
+				record.params[3] = m.as<metal>().fuzz;
+				break;
+			case material_kind::dielectric:
+				record.params[0] = m.as<dielectric>().ir;
+				break;
+			case material_kind::diffuse_light:
+				put_vec3(record.params, m.as<diffuse_light>().emit);
+				break;
+		}
+
+		std::memcpy(&bytes[at.materials + i * sizeof(record)], &record, sizeof(record));
+	}
+
+	size_t n = spheres.size();
+	if (!nodes.empty()) std::memcpy(&bytes[at.nodes], nodes.data(), nodes.size() * sizeof(bvh_flat_node));
+	if (n > 0)
+	{
+		std::memcpy(&bytes[at.center_x], spheres.center_x.data(), n * sizeof(real));
+		std::memcpy(&bytes[at.center_y], spheres.center_y.data(), n * sizeof(real));
+		std::memcpy(&bytes[at.center_z], spheres.center_z.data(), n * sizeof(real));
+		std::memcpy(&bytes[at.radius], spheres.radius.data(), n * sizeof(real));
+		std::memcpy(&bytes[at.mat_id], spheres.mat_id.data(), n * sizeof(material_id));
+	}
+
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "Could not write scene cache " << path << std::endl;
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	return static_cast<bool>(file);
+}
+
+/// <summary>
+/// True if the file starts like a binary scene cache
+/// </summary>
+inline bool is_scene_cache(const std::string& path)
+{
+	char magic[8] = {};
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	return file.read(magic, sizeof(magic)) && std::memcmp(magic, scene_cache_detail::magic, sizeof(magic)) == 0;
+}
+
+/// <summary>
+/// Load a binary scene cache into a scene with a prebuilt sphere BVH
+/// </summary>
+/// <param name="path">Cache file</param>
+/// <param name="out">Scene to fill</param>
+/// <param name="settings">Render settings to take from the cache</param>
+/// <returns>False if the file could not be mapped or is not a valid cache</returns>
+inline bool load_scene_cache(const std::string& path, scene& out, render_settings& settings)
+{
+	using namespace scene_cache_detail;
+
+	mapped_file file;
+	if (!file.open_read(path) || file.length() < sizeof(scene_cache_header))
+	{
+		std::cerr << "Could not open scene cache " << path << std::endl;
+		return false;
+	}
+
+	scene_cache_header header;
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	if (std::memcmp(header.magic, magic, sizeof(header.magic)) == 0 && header.version == version &&
+		(header.real_size != static_cast<int32_t>(sizeof(real)) || header.node_size != static_cast<int32_t>(sizeof(bvh_flat_node))))
+	{
+		std::cerr << "Scene cache " << path << " was written by a build with a different precision or vector layout, "
+			<< "compile it again with --compile-scene" << std::endl;
+		return false;
+	}
+
+	layout at(header.material_count, header.node_count, header.sphere_count);
+	if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != version || at.end == overflow || file.length() < at.end)
+	{
+		std::cerr << "Not a valid scene cache: " << path << std::endl;
+		return false;
+	}
+
+	const unsigned char* bytes = file.data();
+
+	out.materials.materials.reserve(header.material_count);
+	for (uint32_t i = 0; i < header.material_count; ++i)
+	{
+		scene_cache_material record;
+		std::memcpy(&record, bytes + at.materials + i * sizeof(record), sizeof(record));
+
+		color albedo = get_vec3(record.params);
+		switch (static_cast<material_kind>(record.kind))
+		{
+			case material_kind::lambertian: out.materials.add(lambertian(albedo)); break;
+			case material_kind::metal: out.materials.add(metal(albedo, record.params[3])); break;
+			case material_kind::dielectric: out.materials.add(dielectric(record.params[0])); break;
+			case material_kind::diffuse_light: out.materials.add(diffuse_light(albedo)); break;
+			default:
+				std::cerr << "Unknown material kind in scene cache " << path << std::endl;
+				return false;
+		}
+	}
+
+	auto accel = make_shared<packed_sphere_bvh>();
+	size_t n = static_cast<size_t>(header.sphere_count);
+
+	accel->tree.nodes.resize(static_cast<size_t>(header.node_count));
+	if (!accel->tree.nodes.empty())
+	{
+		std::memcpy(accel->tree.nodes.data(), bytes + at.nodes, accel->tree.nodes.size() * sizeof(bvh_flat_node));
+	}
+
+	accel->spheres.assign(n,
+		reinterpret_cast<const real*>(bytes + at.center_x),
+		reinterpret_cast<const real*>(bytes + at.center_y),
+		reinterpret_cast<const real*>(bytes + at.center_z),
+		reinterpret_cast<const real*>(bytes + at.radius),
+		reinterpret_cast<const material_id*>(bytes + at.mat_id));
+
+	// A corrupt or stale cache must fail here, not send traversal out of bounds
+	bool valid = accel->tree.valid(n);
+	for (size_t i = 0; valid && i < n; ++i)
+	{
+		valid = accel->spheres.mat_id[i] < header.material_count;
+	}
+
+	if (!valid)
+	{
+		std::cerr << "Not a valid scene cache: " << path << std::endl;
+		out.materials.materials.clear();
+		return false;
+	}
+
+	out.prebuilt = accel;
+
+	settings.width = header.width;
+	settings.samples_per_pixel = header.samples_per_pixel;
+	settings.min_samples = header.min_samples;
+	settings.max_depth = header.max_depth;
+	settings.roulette_depth = header.roulette_depth;
+	settings.adaptive_threshold = header.adaptive_threshold;
+
+	out.view.lookfrom = get_vec3(header.lookfrom);
+	out.view.lookat = get_vec3(header.lookat);
+	out.view.up = get_vec3(header.up);
+	out.view.vfov = header.vfov;
+	out.view.aspect = header.aspect;
+	out.view.aperture = header.aperture;
+	out.view.focus_distance = header.focus_distance;
+	out.sky.nadir = get_vec3(header.sky_nadir);
+	out.sky.zenith = get_vec3(header.sky_zenith);
+
+	return true;
+}
+
+/// <summary>
+/// Load a scene from a text file or a binary cache, told apart by the cache's magic
+/// </summary>
+/// <param name="path">Scene file</param>
+/// <param name="out">Scene to fill</param>
+/// <param name="settings">Render settings the scene updates</param>
+/// <returns>False if the scene could not be loaded</returns>
+inline bool load_scene(const std::string& path, scene& out, render_settings& settings)
+{
+	if (is_scene_cache(path))
+	{
+		return load_scene_cache(path, out, settings);
+	}
+
+	return load_scene_text(path, out, settings);
+}
+
+#endif // !SCENE_CACHE_H
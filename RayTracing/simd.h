@@ -0,0 +1,263 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "precision.h"
+
+#include <cmath>
+
+// Pick the widest vector of reals the compiler targets: 4 doubles or 8
+// floats with AVX, 2 doubles or 4 floats with SSE2.
+// Define RT_NO_SIMD to force the scalar fallback.
+#if !defined(RT_NO_SIMD) && defined(__AVX__)
+#define RT_SIMD_AVX 1
+#include <immintrin.h>
+#elif !defined(RT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RT_SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define RT_SIMD_SCALAR 1
+#endif
+
+#if defined(RT_SIMD_AVX) && !defined(RT_FLOAT)
+
+/// <summary>
+/// Lane mask produced by comparisons of simd_real (AVX, 4 double lanes)
+/// </summary>
+struct simd_mask
+{
+	__m256d m;
+
+	simd_mask operator&(simd_mask o) const { return { _mm256_and_pd(m, o.m) }; }
+	simd_mask operator|(simd_mask o) const { return { _mm256_or_pd(m, o.m) }; }
+	bool any() const { return _mm256_movemask_pd(m) != 0; }
+	int bits() const { return _mm256_movemask_pd(m); }
+};
+
+/// <summary>
+/// Pack of doubles processed together (AVX, 4 lanes)
+/// </summary>
+struct simd_real
+{
+	static const int width = 4;
+	__m256d v;
+
+	simd_real() : v(_mm256_setzero_pd()) {}
+	simd_real(__m256d x) : v(x) {}
+	simd_real(double x) : v(_mm256_set1_pd(x)) {}
+
+	static simd_real load(const double* p) { return _mm256_loadu_pd(p); }
+	static simd_real iota(double base) { return _mm256_set_pd(base + 3.0, base + 2.0, base + 1.0, base); }
+	void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+	simd_real operator+(simd_real o) const { return _mm256_add_pd(v, o.v); }
+	simd_real operator-(simd_real o) const { return _mm256_sub_pd(v, o.v); }
+	simd_real operator*(simd_real o) const { return _mm256_mul_pd(v, o.v); }
+	simd_real operator/(simd_real o) const { return _mm256_div_pd(v, o.v); }
+	simd_real operator-() const { return _mm256_sub_pd(_mm256_setzero_pd(), v); }
+
+	simd_mask operator<(simd_real o) const { return { _mm256_cmp_pd(v, o.v, _CMP_LT_OQ) }; }
+	simd_mask operator<=(simd_real o) const { return { _mm256_cmp_pd(v, o.v, _CMP_LE_OQ) }; }
+	simd_mask operator>=(simd_real o) const { return { _mm256_cmp_pd(v, o.v, _CMP_GE_OQ) }; }
+};
+
+inline simd_real simd_sqrt(simd_real a) { return _mm256_sqrt_pd(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return _mm256_min_pd(a.v, b.v); }
+inline simd_real simd_max(simd_real a, simd_real b) { return _mm256_max_pd(a.v, b.v); }
+inline simd_real simd_select(simd_mask m, simd_real a, simd_real b) { return _mm256_blendv_pd(b.v, a.v, m.m); }
+
+#elif defined(RT_SIMD_AVX)
+
+/// <summary>
+/// Lane mask produced by comparisons of simd_real (AVX, 8 float lanes)
+/// </summary>
+struct simd_mask
+{
+	__m256 m;
+
+	simd_mask operator&(simd_mask o) const { return { _mm256_and_ps(m, o.m) }; }
+	simd_mask operator|(simd_mask o) const { return { _mm256_or_ps(m, o.m) }; }
+	bool any() const { return _mm256_movemask_ps(m) != 0; }
+	int bits() const { return _mm256_movemask_ps(m); }
+};
+
+/// <summary>
+/// Pack of floats processed together (AVX, 8 lanes)
+/// </summary>
+struct simd_real
+{
+	static const int width = 8;
+	__m256 v;
+
+	simd_real() : v(_mm256_setzero_ps()) {}
+	simd_real(__m256 x) : v(x) {}
+	simd_real(float x) : v(_mm256_set1_ps(x)) {}
+
+	static simd_real load(const float* p) { return _mm256_loadu_ps(p); }
+	static simd_real iota(float base) { return _mm256_add_ps(_mm256_set1_ps(base), _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f)); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	simd_real operator+(simd_real o) const { return _mm256_add_ps(v, o.v); }
+	simd_real operator-(simd_real o) const { return _mm256_sub_ps(v, o.v); }
+	simd_real operator*(simd_real o) const { return _mm256_mul_ps(v, o.v); }
+	simd_real operator/(simd_real o) const { return _mm256_div_ps(v, o.v); }
+	simd_real operator-() const { return _mm256_sub_ps(_mm256_setzero_ps(), v); }
+
+	simd_mask operator<(simd_real o) const { return { _mm256_cmp_ps(v, o.v, _CMP_LT_OQ) }; }
+	simd_mask operator<=(simd_real o) const { return { _mm256_cmp_ps(v, o.v, _CMP_LE_OQ) }; }
+	simd_mask operator>=(simd_real o) const { return { _mm256_cmp_ps(v, o.v, _CMP_GE_OQ) }; }
+};
+
+inline simd_real simd_sqrt(simd_real a) { return _mm256_sqrt_ps(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return _mm256_min_ps(a.v, b.v); }
+inline simd_real simd_max(simd_real a, simd_real b) { return _mm256_max_ps(a.v, b.v); }
+inline simd_real simd_select(simd_mask m, simd_real a, simd_real b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+#elif defined(RT_SIMD_SSE2) && !defined(RT_FLOAT)
+
+/// <summary>
+/// Lane mask produced by comparisons of simd_real (SSE2, 2 double lanes)
+/// </summary>
+struct simd_mask
+{
+	__m128d m;
+
+	simd_mask operator&(simd_mask o) const { return { _mm_and_pd(m, o.m) }; }
+	simd_mask operator|(simd_mask o) const { return { _mm_or_pd(m, o.m) }; }
+	bool any() const { return _mm_movemask_pd(m) != 0; }
+	int bits() const { return _mm_movemask_pd(m); }
+};
+
+/// <summary>
+/// Pack of doubles processed together (SSE2, 2 lanes)
+/// </summary>
+struct simd_real
+{
+	static const int width = 2;
+	__m128d v;
+
+	simd_real() : v(_mm_setzero_pd()) {}
+	simd_real(__m128d x) : v(x) {}
+	simd_real(double x) : v(_mm_set1_pd(x)) {}
+
+	static simd_real load(const double* p) { return _mm_loadu_pd(p); }
+	static simd_real iota(double base) { return _mm_set_pd(base + 1.0, base); }
+	void store(double* p) const { _mm_storeu_pd(p, v); }
+
+	simd_real operator+(simd_real o) const { return _mm_add_pd(v, o.v); }
+	simd_real operator-(simd_real o) const { return _mm_sub_pd(v, o.v); }
+	simd_real operator*(simd_real o) const { return _mm_mul_pd(v, o.v); }
+	simd_real operator/(simd_real o) const { return _mm_div_pd(v, o.v); }
+	simd_real operator-() const { return _mm_sub_pd(_mm_setzero_pd(), v); }
+
+	simd_mask operator<(simd_real o) const { return { _mm_cmplt_pd(v, o.v) }; }
+	simd_mask operator<=(simd_real o) const { return { _mm_cmple_pd(v, o.v) }; }
+	simd_mask operator>=(simd_real o) const { return { _mm_cmpge_pd(v, o.v) }; }
+};
+
+inline simd_real simd_sqrt(simd_real a) { return _mm_sqrt_pd(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return _mm_min_pd(a.v, b.v); }
+inline simd_real simd_max(simd_real a, simd_real b) { return _mm_max_pd(a.v, b.v); }
+inline simd_real simd_select(simd_mask m, simd_real a, simd_real b)
+{
+	return _mm_or_pd(_mm_and_pd(m.m, a.v), _mm_andnot_pd(m.m, b.v));
+}
+
+#elif defined(RT_SIMD_SSE2)
+
+/// <summary>
+/// Lane mask produced by comparisons of simd_real (SSE, 4 float lanes)
+/// </summary>
+struct simd_mask
+{
+	__m128 m;
+
+	simd_mask operator&(simd_mask o) const { return { _mm_and_ps(m, o.m) }; }
+	simd_mask operator|(simd_mask o) const { return { _mm_or_ps(m, o.m) }; }
+	bool any() const { return _mm_movemask_ps(m) != 0; }
+	int bits() const { return _mm_movemask_ps(m); }
+};
+
+/// <summary>
+/// Pack of floats processed together (SSE, 4 lanes)
+/// </summary>
+struct simd_real
+{
+	static const int width = 4;
+	__m128 v;
+
+	simd_real() : v(_mm_setzero_ps()) {}
+	simd_real(__m128 x) : v(x) {}
+	simd_real(float x) : v(_mm_set1_ps(x)) {}
+
+	static simd_real load(const float* p) { return _mm_loadu_ps(p); }
+	static simd_real iota(float base) { return _mm_add_ps(_mm_set1_ps(base), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+
+	simd_real operator+(simd_real o) const { return _mm_add_ps(v, o.v); }
+	simd_real operator-(simd_real o) const { return _mm_sub_ps(v, o.v); }
+	simd_real operator*(simd_real o) const { return _mm_mul_ps(v, o.v); }
+	simd_real operator/(simd_real o) const { return _mm_div_ps(v, o.v); }
+	simd_real operator-() const { return _mm_sub_ps(_mm_setzero_ps(), v); }
+
+	simd_mask operator<(simd_real o) const { return { _mm_cmplt_ps(v, o.v) }; }
+	simd_mask operator<=(simd_real o) const { return { _mm_cmple_ps(v, o.v) }; }
+	simd_mask operator>=(simd_real o) const { return { _mm_cmpge_ps(v, o.v) }; }
+};
+
+inline simd_real simd_sqrt(simd_real a) { return _mm_sqrt_ps(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return _mm_min_ps(a.v, b.v); }
+inline simd_real simd_max(simd_real a, simd_real b) { return _mm_max_ps(a.v, b.v); }
+inline simd_real simd_select(simd_mask m, simd_real a, simd_real b)
+{
+	return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+
+#else
+
+/// <summary>
+/// Lane mask of the scalar fallback
+/// </summary>
+struct simd_mask
+{
+	bool m;
+
+	simd_mask operator&(simd_mask o) const { return { m && o.m }; }
+	simd_mask operator|(simd_mask o) const { return { m || o.m }; }
+	bool any() const { return m; }
+	int bits() const { return m ? 1 : 0; }
+};
+
+/// <summary>
+/// Scalar fallback with the same interface as the vector types
+/// </summary>
+struct simd_real
+{
+	static const int width = 1;
+	real v;
+
+	simd_real() : v(0.0) {}
+	simd_real(real x) : v(x) {}
+
+	static simd_real load(const real* p) { return *p; }
+	static simd_real iota(real base) { return base; }
+	void store(real* p) const { *p = v; }
+
+	simd_real operator+(simd_real o) const { return v + o.v; }
+	simd_real operator-(simd_real o) const { return v - o.v; }
+	simd_real operator*(simd_real o) const { return v * o.v; }
+	simd_real operator/(simd_real o) const { return v / o.v; }
+	simd_real operator-() const { return -v; }
+
+	simd_mask operator<(simd_real o) const { return { v < o.v }; }
+	simd_mask operator<=(simd_real o) const { return { v <= o.v }; }
+	simd_mask operator>=(simd_real o) const { return { v >= o.v }; }
+};
+
+inline simd_real simd_sqrt(simd_real a) { return std::sqrt(a.v); }
+inline simd_real simd_min(simd_real a, simd_real b) { return a.v < b.v ? a.v : b.v; }
+inline simd_real simd_max(simd_real a, simd_real b) { return a.v > b.v ? a.v : b.v; }
+inline simd_real simd_select(simd_mask m, simd_real a, simd_real b) { return m.m ? a : b; }
+
+#endif
+
+#endif // !SIMD_H
@@ -2,36 +2,58 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "stats.h"
 #include "vec3.h"
 
 class sphere : public hittable
 {
 public:
-	point3 center;
-	double radius;
-    shared_ptr<material> mat_ptr;
+	point3 center; // Center at time 0
+	real radius;
+    material_id mat_id = 0;
+    vec3 velocity = vec3(0.0, 0.0, 0.0); // Units per second
 
     sphere() {}
-	sphere(point3 center, double r) : center(center), radius(r) {};
-    sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
+	sphere(point3 center, real r) : center(center), radius(r) {};
+    sphere(point3 cen, real r, material_id m) : center(cen), radius(r), mat_id(m) {};
+    sphere(point3 cen, real r, material_id m, const vec3& v) : center(cen), radius(r), mat_id(m), velocity(v) {};
 
-	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
+	virtual bool set_frame(real time, real shutter) override;
+	virtual size_t memory_bytes() const override { return sizeof(*this); }
+
+    bool moving() const { return !(velocity.x() == 0 && velocity.y() == 0 && velocity.z() == 0); }
+
+    /// <summary>
+    /// Center at a ray time of the current frame
+    /// </summary>
+    point3 center_at(real time) const { return center + (frame_time + frame_shutter * time) * velocity; }
+
+private:
+    real frame_time = 0;
+    real frame_shutter = 0;
 
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     bool hit = false;
+    RT_STAT(thread_stats().sphere_tests++);
 
-    vec3 oc = r.origin() - center; // Make ray from the center of the sphere
+    point3 c = center_at(r.time());
+    vec3 oc = r.origin() - c; // Make ray from the center of the sphere
 
     // Get coefficients of equation (use b=2h to simplify equation)
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
 
-    // Calculate and check discriminant for hit
-    auto discriminant = half_b * half_b - a * c;
+    // Calculate and check discriminant for hit. Written as the distance from
+    // the center to the ray's line instead of half_b^2 - a*c, which cancels
+    // badly for small or distant spheres, most of all in single precision
+    vec3 to_line = oc - (half_b / a) * r.direction();
+    auto discriminant = a * (radius * radius - to_line.length_squared());
     if (discriminant >= 0.0)
     {
         auto sqrtd = sqrt(discriminant);
@@ -52,9 +74,9 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
         rec.t = root;
         rec.p = r.at(rec.t);
         
-        vec3 outward_normal = (rec.p - center) / radius; // Calculate outward normal
+        vec3 outward_normal = (rec.p - c) / radius; // Calculate outward normal
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat_ptr;
+        rec.mat_id = mat_id;
 
         hit = true;
     }
@@ -62,4 +84,44 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     return hit;
 }
 
+bool sphere::occluded(const ray& r, real t_min, real t_max) const
+{
+    RT_STAT(thread_stats().sphere_tests++);
+
+    vec3 oc = r.origin() - center_at(r.time());
+
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+
+    // Same discriminant as hit, but either root in range will do
+    vec3 to_line = oc - (half_b / a) * r.direction();
+    auto discriminant = a * (radius * radius - to_line.length_squared());
+    if (discriminant < 0.0) return false;
+
+    auto sqrtd = sqrt(discriminant);
+    auto near_root = (-half_b - sqrtd) / a;
+    auto far_root = (-half_b + sqrtd) / a;
+
+    return (t_min <= near_root && near_root <= t_max) || (t_min <= far_root && far_root <= t_max);
+}
+
+bool sphere::bounding_box(aabb& output_box) const
+{
+    // Negative radii are used for hollow glass, the box only cares about the size
+    auto r = fabs(radius);
+    point3 open = center_at(0), close = center_at(1);
+    output_box = aabb(open - vec3(r, r, r), open + vec3(r, r, r));
+    output_box.expand(aabb(close - vec3(r, r, r), close + vec3(r, r, r)));
+    return true;
+}
+
+bool sphere::set_frame(real time, real shutter)
+{
+    if (!moving()) return false;
+
+    frame_time = time;
+    frame_shutter = shutter;
+    return true;
+}
+
 #endif // !SPHERE_H
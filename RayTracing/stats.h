@@ -0,0 +1,254 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Counters of what a render does, kept per thread. Each thread only ever
+/// writes its own copy, so counting takes no locks or atomics; the copies
+/// are summed once the render is over.
+///
+/// Counting is compiled in with RT_STATS. Without it RT_STAT(...) expands
+/// to nothing and the hot paths are exactly as they would be without this
+/// header.
+/// </summary>
+struct render_stats
+{
+	static const int max_bounces = 64; // Deeper bounces share the last bucket
+	static const int material_kinds = 4;
+
+	uint64_t rays[max_bounces] = {};         // Rays traced at each bounce, 0 for camera rays
+	uint64_t path_lengths[max_bounces] = {}; // Paths by the number of rays they traced
+	uint64_t sphere_tests = 0;               // Ray-sphere tests, scalar or a vector lane each
+	uint64_t triangle_tests = 0;
+	uint64_t box_tests = 0;                  // BVH node boxes tested, once per ray
+	uint64_t shadow_rays = 0;                // Rays toward lights, not counted in rays
+	uint64_t material_hits[material_kinds] = {};
+	uint64_t absorbed[material_kinds] = {};  // Hits whose scatter absorbed the path
+	uint64_t tiles = 0;
+	double tile_seconds = 0.0;
+	double tile_seconds_min = std::numeric_limits<double>::infinity();
+	double tile_seconds_max = 0.0;
+
+	void trace_ray(int bounce) { rays[std::min(bounce, max_bounces - 1)]++; }
+
+	void end_path(int rays_traced) { path_lengths[std::min(rays_traced, max_bounces - 1)]++; }
+
+	void hit_material(int kind, bool scattered)
+	{
+		material_hits[kind]++;
+		if (!scattered) absorbed[kind]++;
+	}
+
+	void add_tile(double seconds)
+	{
+		tiles++;
+		tile_seconds += seconds;
+		tile_seconds_min = std::min(tile_seconds_min, seconds);
+		tile_seconds_max = std::max(tile_seconds_max, seconds);
+	}
+
+	uint64_t total_rays() const
+	{
+		uint64_t total = 0;
+		for (uint64_t n : rays) total += n;
+		return total;
+	}
+
+	uint64_t total_paths() const
+	{
+		uint64_t total = 0;
+		for (uint64_t n : path_lengths) total += n;
+		return total;
+	}
+
+	void merge(const render_stats& o)
+	{
+		for (int b = 0; b < max_bounces; ++b)
+		{
+			rays[b] += o.rays[b];
+			path_lengths[b] += o.path_lengths[b];
+		}
+		for (int k = 0; k < material_kinds; ++k)
+		{
+			material_hits[k] += o.material_hits[k];
+			absorbed[k] += o.absorbed[k];
+		}
+		sphere_tests += o.sphere_tests;
+		triangle_tests += o.triangle_tests;
+		box_tests += o.box_tests;
+		shadow_rays += o.shadow_rays;
+		tiles += o.tiles;
+		tile_seconds += o.tile_seconds;
+		tile_seconds_min = std::min(tile_seconds_min, o.tile_seconds_min);
+		tile_seconds_max = std::max(tile_seconds_max, o.tile_seconds_max);
+	}
+};
+
+/// <summary>
+/// Owner of every thread's counters, plus wall times of the program's
+/// phases, which only the main thread records
+/// </summary>
+class stats_registry
+{
+public:
+	struct phase
+	{
+		std::string name;
+		double seconds;
+	};
+
+	static stats_registry& instance()
+	{
+		static stats_registry registry;
+		return registry;
+	}
+
+	/// <summary>
+	/// Counters for a new thread. They live as long as the registry, so a
+	/// thread can keep the pointer.
+	/// </summary>
+	render_stats* add_thread()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		threads.push_back(std::unique_ptr<render_stats>(new render_stats()));
+		return threads.back().get();
+	}
+
+	/// <summary>
+	/// Sum of every thread's counters. Call while no thread is counting.
+	/// </summary>
+	render_stats total()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		render_stats sum;
+		for (const auto& t : threads) sum.merge(*t);
+		return sum;
+	}
+
+	/// <summary>
+	/// Zero every thread's counters and forget the phases
+	/// </summary>
+	void reset()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& t : threads) *t = render_stats();
+		phases.clear();
+	}
+
+	void add_phase(const std::string& name, double seconds) { phases.push_back({ name, seconds }); }
+
+	const std::vector<phase>& phase_times() const { return phases; }
+
+private:
+	std::mutex lock;
+	std::vector<std::unique_ptr<render_stats>> threads;
+	std::vector<phase> phases;
+};
+
+/// <summary>
+/// Counters of the calling thread
+/// </summary>
+inline render_stats& thread_stats()
+{
+	thread_local render_stats* local = stats_registry::instance().add_thread();
+	return *local;
+}
+
+#ifdef RT_STATS
+#define RT_STAT(statement) statement
+#else
+#define RT_STAT(statement)
+#endif
+
+/// <summary>
+/// Write counters, phase times and the distribution of samples per pixel as JSON
+/// </summary>
+/// <param name="out">Stream to write to</param>
+/// <param name="s">Counters summed over the threads</param>
+/// <param name="phases">Wall time of the program's phases</param>
+/// <param name="pixel_samples">Samples of every pixel</param>
+inline void write_stats_json(std::ostream& out, const render_stats& s, const std::vector<stats_registry::phase>& phases, const std::vector<uint32_t>& pixel_samples)
+{
+	static const char* material_names[render_stats::material_kinds] = { "lambertian", "metal", "dielectric", "diffuse_light" };
+
+	auto last_nonzero = [](const uint64_t* counts, int n) {
+		while (n > 1 && counts[n - 1] == 0) --n;
+		return n;
+	};
+
+	auto write_array = [&](const uint64_t* counts, int n) {
+		out << "[";
+		for (int k = 0; k < n; ++k) out << (k ? ", " : "") << counts[k];
+		out << "]";
+	};
+
+	uint64_t rays = s.total_rays();
+	double per_ray = rays > 0 ? 1.0 / static_cast<double>(rays) : 0.0;
+
+	out << "{\n";
+	out << "  \"rays\": " << rays << ",\n";
+	out << "  \"rays_per_bounce\": ";
+	write_array(s.rays, last_nonzero(s.rays, render_stats::max_bounces));
+	out << ",\n";
+
+	out << "  \"paths\": " << s.total_paths() << ",\n";
+	out << "  \"path_length_histogram\": ";
+	write_array(s.path_lengths, last_nonzero(s.path_lengths, render_stats::max_bounces));
+	out << ",\n";
+
+	out << "  \"intersection_tests\": { \"sphere\": " << s.sphere_tests << ", \"triangle\": " << s.triangle_tests << ", \"box\": " << s.box_tests
+		<< ", \"per_ray\": " << static_cast<double>(s.sphere_tests + s.triangle_tests + s.box_tests) * per_ray << " },\n";
+
+	out << "  \"shadow_rays\": " << s.shadow_rays << ",\n";
+
+	out << "  \"material_hits\": {";
+	for (int k = 0; k < render_stats::material_kinds; ++k)
+	{
+		out << (k ? ", " : " ") << "\"" << material_names[k] << "\": { \"hits\": " << s.material_hits[k] << ", \"absorbed\": " << s.absorbed[k] << " }";
+	}
+	out << " },\n";
+
+	// Samples per pixel: summary and a histogram in power-of-two buckets [2^k, 2^(k+1))
+	uint64_t total = 0;
+	uint32_t low = pixel_samples.empty() ? 0 : std::numeric_limits<uint32_t>::max();
+	uint32_t high = 0;
+	std::vector<uint64_t> buckets;
+	for (uint32_t n : pixel_samples)
+	{
+		total += n;
+		low = std::min(low, n);
+		high = std::max(high, n);
+
+		size_t bucket = 0;
+		while ((uint64_t(2) << bucket) <= n) bucket++;
+		if (buckets.size() <= bucket) buckets.resize(bucket + 1, 0);
+		buckets[bucket]++;
+	}
+
+	out << "  \"samples_per_pixel\": { \"total\": " << total << ", \"min\": " << low << ", \"max\": " << high
+		<< ", \"mean\": " << (pixel_samples.empty() ? 0.0 : static_cast<double>(total) / pixel_samples.size()) << ", \"log2_histogram\": ";
+	write_array(buckets.data(), static_cast<int>(buckets.size()));
+	out << " },\n";
+
+	out << "  \"tiles\": { \"count\": " << s.tiles << ", \"seconds\": " << s.tile_seconds
+		<< ", \"min_seconds\": " << (s.tiles ? s.tile_seconds_min : 0.0) << ", \"max_seconds\": " << s.tile_seconds_max
+		<< ", \"mean_seconds\": " << (s.tiles ? s.tile_seconds / s.tiles : 0.0) << " },\n";
+
+	out << "  \"phases\": {";
+	for (size_t k = 0; k < phases.size(); ++k)
+	{
+		out << (k ? ", " : " ") << "\"" << phases[k].name << "\": " << phases[k].seconds;
+	}
+	out << " }\n";
+	out << "}" << std::endl;
+}
+
+#endif // !STATS_H
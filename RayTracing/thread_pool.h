@@ -0,0 +1,235 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Fixed-size pool of worker threads with one task deque per worker.
+/// Workers pop their own deque from the back and steal from the front
+/// of the other deques when they run dry, so uneven tiles balance out.
+/// </summary>
+class thread_pool
+{
+public:
+	/// <summary>
+	/// Start the workers
+	/// </summary>
+	/// <param name="thread_count">Number of workers, 0 for one per hardware thread</param>
+	explicit thread_pool(unsigned thread_count = 0)
+	{
+		if (thread_count == 0)
+		{
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (unsigned i = 0; i < thread_count; ++i)
+		{
+			queues.push_back(std::make_unique<work_queue>());
+		}
+
+		for (unsigned i = 0; i < thread_count; ++i)
+		{
+			workers.emplace_back([this, i] { worker_loop(i); });
+		}
+	}
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+	/// <summary>
+	/// Index of the calling worker, or -1 when called from outside the pool
+	/// </summary>
+	static int worker_index() { return current_worker(); }
+
+	/// <summary>
+	/// Queue a task. Tasks submitted from a worker go to its own deque,
+	/// everything else is spread round-robin over the workers.
+	/// </summary>
+	/// <param name="task">Task to run</param>
+	void submit(std::function<void()> task)
+	{
+		int self = current_worker();
+		unsigned target = self >= 0 ? static_cast<unsigned>(self) : next_queue++ % size();
+
+		{
+			std::lock_guard<std::mutex> lock(queues[target]->mutex);
+			queues[target]->tasks.push_back(std::move(task));
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			++queued;
+			++unfinished;
+		}
+		work_available.notify_one();
+	}
+
+	/// <summary>
+	/// Block until every submitted task has finished. Must not be called
+	/// from a task, which would wait for itself; use parallel_for there.
+	/// </summary>
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(state_mutex);
+		all_done.wait(lock, [this] { return unfinished == 0; });
+	}
+
+	/// <summary>
+	/// Run fn(i) for every i in [0, count) on the pool and wait for all of
+	/// them. The call waits for its own iterations only, and a worker that
+	/// calls it runs queued tasks while it waits, so tasks may nest it.
+	/// </summary>
+	/// <param name="count">Number of iterations</param>
+	/// <param name="fn">Callable taking the iteration index</param>
+	template <typename Fn>
+	void parallel_for(int count, Fn&& fn)
+	{
+		long remaining = count;
+
+		for (int i = 0; i < count; ++i)
+		{
+			submit([this, &fn, &remaining, i] {
+				fn(i);
+
+				std::lock_guard<std::mutex> lock(state_mutex);
+				if (--remaining == 0)
+				{
+					all_done.notify_all();
+				}
+			});
+		}
+
+		int self = current_worker();
+		while (self >= 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(state_mutex);
+				if (remaining == 0) return;
+			}
+
+			// Any task will do: ours, or one that ours are waiting behind
+			std::function<void()> task;
+			if (!pop_local(static_cast<unsigned>(self), task) && !steal(static_cast<unsigned>(self), task)) break;
+			run(task);
+		}
+
+		// The rest are running on other threads
+		std::unique_lock<std::mutex> lock(state_mutex);
+		all_done.wait(lock, [&remaining] { return remaining == 0; });
+	}
+
+private:
+	struct work_queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<work_queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> next_queue{ 0 };
+
+	std::mutex state_mutex;
+	std::condition_variable work_available;
+	std::condition_variable all_done;
+	long queued = 0;     // Tasks sitting in a deque
+	long unfinished = 0; // Tasks queued or running
+	bool stopping = false;
+
+	static int& current_worker()
+	{
+		static thread_local int index = -1;
+		return index;
+	}
+
+	bool pop_local(unsigned index, std::function<void()>& task)
+	{
+		auto& queue = *queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) return false;
+
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(unsigned thief, std::function<void()>& task)
+	{
+		for (unsigned offset = 1; offset < size(); ++offset)
+		{
+			auto& victim = *queues[(thief + offset) % size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.tasks.empty()) continue;
+
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+
+		return false;
+	}
+
+	// Run a task taken from a deque and account for it
+	void run(std::function<void()>& task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			--queued;
+		}
+
+		task();
+
+		std::lock_guard<std::mutex> lock(state_mutex);
+		if (--unfinished == 0)
+		{
+			all_done.notify_all();
+		}
+	}
+
+	void worker_loop(unsigned index)
+	{
+		current_worker() = static_cast<int>(index);
+
+		while (true)
+		{
+			std::function<void()> task;
+
+			if (pop_local(index, task) || steal(index, task))
+			{
+				run(task);
+				continue;
+			}
+
+			// Nothing to pop or steal, sleep until new work is submitted
+			std::unique_lock<std::mutex> lock(state_mutex);
+			work_available.wait(lock, [this] { return stopping || queued > 0; });
+			if (stopping && queued <= 0) return;
+		}
+	}
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,144 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+/// <summary>
+/// Affine transform stored as a 3x3 linear part plus a translation
+/// </summary>
+class affine_transform
+{
+public:
+	real m[3][3];
+	vec3 offset;
+
+	/// <summary>
+	/// Identity
+	/// </summary>
+	affine_transform() : m{ { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } }, offset(0.0, 0.0, 0.0) {}
+
+	static affine_transform translate(const vec3& t)
+	{
+		affine_transform result;
+		result.offset = t;
+		return result;
+	}
+
+	static affine_transform scale(const vec3& s)
+	{
+		affine_transform result;
+		for (int a = 0; a < 3; ++a) result.m[a][a] = s[a];
+		return result;
+	}
+
+	/// <summary>
+	/// Rotation around an axis through the origin
+	/// </summary>
+	/// <param name="axis">Rotation axis, need not be normalized</param>
+	/// <param name="degrees">Counter-clockwise angle looking down the axis</param>
+	static affine_transform rotate(const vec3& axis, real degrees)
+	{
+		vec3 a = unit_vector(axis);
+		real c = cos(degrees_to_radians(degrees));
+		real s = sin(degrees_to_radians(degrees));
+		real k = 1.0 - c;
+
+		affine_transform result;
+		result.m[0][0] = c + a.x() * a.x() * k;
+		result.m[0][1] = a.x() * a.y() * k - a.z() * s;
+		result.m[0][2] = a.x() * a.z() * k + a.y() * s;
+		result.m[1][0] = a.y() * a.x() * k + a.z() * s;
+		result.m[1][1] = c + a.y() * a.y() * k;
+		result.m[1][2] = a.y() * a.z() * k - a.x() * s;
+		result.m[2][0] = a.z() * a.x() * k - a.y() * s;
+		result.m[2][1] = a.z() * a.y() * k + a.x() * s;
+		result.m[2][2] = c + a.z() * a.z() * k;
+		return result;
+	}
+
+	vec3 apply_vector(const vec3& v) const
+	{
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+	}
+
+	point3 apply_point(const point3& p) const { return apply_vector(p) + offset; }
+
+	/// <summary>
+	/// Transform a normal given this transform's inverse, i.e. multiply by
+	/// the inverse transpose so it stays perpendicular to transformed surfaces
+	/// </summary>
+	static vec3 apply_normal(const affine_transform& inverse, const vec3& n)
+	{
+		const auto& w = inverse.m;
+		return vec3(
+			w[0][0] * n.x() + w[1][0] * n.y() + w[2][0] * n.z(),
+			w[0][1] * n.x() + w[1][1] * n.y() + w[2][1] * n.z(),
+			w[0][2] * n.x() + w[1][2] * n.y() + w[2][2] * n.z());
+	}
+
+	/// <summary>
+	/// Box enclosing the transformed corners of a box
+	/// </summary>
+	aabb apply_box(const aabb& box) const
+	{
+		aabb result;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			point3 p(
+				corner & 1 ? box.maximum.x() : box.minimum.x(),
+				corner & 2 ? box.maximum.y() : box.minimum.y(),
+				corner & 4 ? box.maximum.z() : box.minimum.z());
+			result.expand(apply_point(p));
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Inverse transform. The linear part must not be singular.
+	/// </summary>
+	affine_transform inverse() const
+	{
+		real det =
+			m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+			m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+			m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+		real inv_det = 1.0 / det;
+
+		affine_transform result;
+		result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+		result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+		result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+		result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+		result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+		result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+		result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+		result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+		result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+		result.offset = -result.apply_vector(offset);
+		return result;
+	}
+};
+
+/// <summary>
+/// Composition: apply b first, then a
+/// </summary>
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b)
+{
+	affine_transform result;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+		}
+	}
+	result.offset = a.apply_point(b.offset);
+	return result;
+}
+
+#endif // !TRANSFORM_H
@@ -0,0 +1,223 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Indexed triangle mesh: one shared vertex buffer and three indices per
+/// triangle, with an optional buffer of shading normals indexed the same
+/// way. After build() the triangles sit in the order of the mesh's own BVH
+/// leaves, so a leaf reads a contiguous run of indices.
+/// </summary>
+class triangle_mesh : public hittable
+{
+public:
+	std::vector<point3> positions;
+	std::vector<vec3> normals;
+	std::vector<uint32_t> indices;        // 3 position indices per triangle
+	std::vector<uint32_t> normal_indices; // 3 normal indices per triangle, empty for flat shading
+	material_id mat_id = 0;
+	bvh_tree tree;
+
+	static const int leaf_size = 4;
+
+	triangle_mesh() {}
+
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	bool has_normals() const { return !normal_indices.empty(); }
+
+	/// <summary>
+	/// Build the BVH over the triangles and sort them into leaf order.
+	/// Must be called after the buffers are filled and before rendering.
+	/// </summary>
+	void build()
+	{
+		size_t count = triangle_count();
+
+		std::vector<aabb> boxes(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			boxes[i] = aabb();
+			for (int k = 0; k < 3; ++k)
+			{
+				boxes[i].expand(positions[indices[3 * i + k]]);
+			}
+		}
+
+		tree.build(boxes, leaf_size);
+
+		reorder(indices);
+		if (has_normals()) reorder(normal_indices);
+	}
+
+	virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+	{
+		const watertight_ray wr(r);
+
+		size_t closest = 0;
+		real closest_t = t_max;
+		real closest_b1 = 0.0, closest_b2 = 0.0;
+
+		bool hit_anything = tree.traverse(r, t_min, t_max, [&](int first, int count, real closest_so_far) {
+			RT_STAT(thread_stats().triangle_tests += static_cast<uint64_t>(count));
+			for (int i = first; i < first + count; ++i)
+			{
+				real t, b1, b2;
+				if (intersect(wr, i, t_min, closest_so_far, t, b1, b2))
+				{
+					closest_so_far = t;
+					closest = i;
+					closest_t = t;
+					closest_b1 = b1;
+					closest_b2 = b2;
+				}
+			}
+
+			return closest_so_far;
+		});
+
+		if (!hit_anything) return false;
+
+		const uint32_t* tri = &indices[3 * closest];
+		const point3& p0 = positions[tri[0]];
+
+		rec.t = closest_t;
+		rec.p = r.at(closest_t);
+		rec.mat_id = mat_id;
+
+		// Which side was hit is decided by the true surface
+		vec3 geometric = unit_vector(cross(positions[tri[1]] - p0, positions[tri[2]] - p0));
+		rec.set_face_normal(r, geometric);
+
+		if (has_normals())
+		{
+			const uint32_t* n = &normal_indices[3 * closest];
+			vec3 shading = unit_vector((1.0 - closest_b1 - closest_b2) * normals[n[0]] + closest_b1 * normals[n[1]] + closest_b2 * normals[n[2]]);
+			rec.normal = rec.front_face ? shading : -shading;
+		}
+
+		return true;
+	}
+
+	virtual bool occluded(const ray& r, real t_min, real t_max) const override
+	{
+		const watertight_ray wr(r);
+
+		return tree.any_hit(r, t_min, t_max, [&](int first, int count) {
+			RT_STAT(thread_stats().triangle_tests += static_cast<uint64_t>(count));
+			for (int i = first; i < first + count; ++i)
+			{
+				real t, b1, b2;
+				if (intersect(wr, i, t_min, t_max, t, b1, b2)) return true;
+			}
+
+			return false;
+		});
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override
+	{
+		output_box = tree.bounds();
+		return !tree.empty();
+	}
+
+	virtual size_t memory_bytes() const override
+	{
+		return sizeof(*this) + positions.capacity() * sizeof(point3) + normals.capacity() * sizeof(vec3) +
+			(indices.capacity() + normal_indices.capacity()) * sizeof(uint32_t) + tree.storage_bytes();
+	}
+
+private:
+	/// <summary>
+	/// Ray set up for the watertight test of Woop, Benthin and Wald (2013):
+	/// the ray's dominant axis becomes z, and a shear maps its direction to +z
+	/// </summary>
+	struct watertight_ray
+	{
+		point3 origin;
+		int kx, ky, kz;
+		real sx, sy, sz;
+
+		explicit watertight_ray(const ray& r) : origin(r.origin())
+		{
+			vec3 d = r.direction();
+
+			kz = 0;
+			if (fabs(d.y()) > fabs(d[kz])) kz = 1;
+			if (fabs(d.z()) > fabs(d[kz])) kz = 2;
+			kx = (kz + 1) % 3;
+			ky = (kx + 1) % 3;
+
+			// Keep the winding when the dominant component is negative
+			if (d[kz] < 0.0) std::swap(kx, ky);
+
+			sx = d[kx] / d[kz];
+			sy = d[ky] / d[kz];
+			sz = 1.0 / d[kz];
+		}
+	};
+
+	/// <summary>
+	/// Watertight ray-triangle test. Edges shared by two triangles are
+	/// decided the same way for both, so rays cannot slip through a mesh.
+	/// </summary>
+	/// <returns>True on a hit in (t_min, t_max), with barycentrics of the second and third vertex</returns>
+	bool intersect(const watertight_ray& r, int triangle, real t_min, real t_max, real& t, real& b1, real& b2) const
+	{
+		const uint32_t* tri = &indices[3 * static_cast<size_t>(triangle)];
+		vec3 a = positions[tri[0]] - r.origin;
+		vec3 b = positions[tri[1]] - r.origin;
+		vec3 c = positions[tri[2]] - r.origin;
+
+		real ax = a[r.kx] - r.sx * a[r.kz];
+		real ay = a[r.ky] - r.sy * a[r.kz];
+		real bx = b[r.kx] - r.sx * b[r.kz];
+		real by = b[r.ky] - r.sy * b[r.kz];
+		real cx = c[r.kx] - r.sx * c[r.kz];
+		real cy = c[r.ky] - r.sy * c[r.kz];
+
+		// Scaled barycentrics as signed edge functions
+		real u = cx * by - cy * bx;
+		real v = ax * cy - ay * cx;
+		real w = bx * ay - by * ax;
+
+		if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) return false;
+
+		real det = u + v + w;
+		if (det == 0.0) return false;
+
+		real scaled_t = u * r.sz * a[r.kz] + v * r.sz * b[r.kz] + w * r.sz * c[r.kz];
+
+		real inv_det = 1.0 / det;
+		t = scaled_t * inv_det;
+		if (t <= t_min || t >= t_max) return false;
+
+		b1 = v * inv_det;
+		b2 = w * inv_det;
+		return true;
+	}
+
+	void reorder(std::vector<uint32_t>& per_corner) const
+	{
+		std::vector<uint32_t> sorted(per_corner.size());
+		for (size_t i = 0; i < tree.indices.size(); ++i)
+		{
+			size_t from = static_cast<size_t>(tree.indices[i]);
+			for (int k = 0; k < 3; ++k)
+			{
+				sorted[3 * i + k] = per_corner[3 * from + k];
+			}
+		}
+		per_corner.swap(sorted);
+	}
+};
+
+#endif // !TRIANGLE_MESH_H
@@ -6,55 +6,57 @@
 
 #include "rtweekend.h"
 
+// Define RT_SIMD_VEC3 to keep vectors padded to four lanes and do their
+// arithmetic, dot, cross and unit_vector in one SIMD register: SSE for
+// float builds, AVX2 for double builds. Otherwise vectors are three plain reals.
+#if defined(RT_SIMD_VEC3) && !defined(RT_NO_SIMD) && \
+    (defined(RT_FLOAT) ? (defined(__SSE2__) || defined(_M_X64)) : defined(__AVX2__))
+#define RT_VEC3_LANES 4
+#include <immintrin.h>
+#else
+#define RT_VEC3_LANES 3
+#endif
+
 using std::sqrt;
 using std::fabs;
 
 class vec3
 {
 public:
-    double e[3];
+#if RT_VEC3_LANES == 4
+    alignas(4 * sizeof(real)) real e[4]; // Last lane is kept at zero
+
+    vec3() : e{ 0,0,0,0 } {}
+    vec3(real e0, real e1, real e2) : e{ e0, e1, e2, 0 } {}
+#else
+    real e[3];
 
     vec3() : e{ 0,0,0 } {}
-    vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+    vec3(real e0, real e1, real e2) : e{ e0, e1, e2 } {}
+#endif
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
 
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
-
-    vec3& operator+=(const vec3& v) 
-    {
-        e[0] += v.e[0];
-        e[1] += v.e[1];
-        e[2] += v.e[2];
-        return *this;
-    }
+    real operator[](int i) const { return e[i]; }
+    real& operator[](int i) { return e[i]; }
 
-    vec3& operator*=(const double t) 
-    {
-        e[0] *= t;
-        e[1] *= t;
-        e[2] *= t;
-        return *this;
-    }
+    vec3& operator+=(const vec3& v);
+    vec3& operator*=(const real t);
 
-    vec3& operator/=(const double t) 
+    vec3& operator/=(const real t) 
     {
         return *this *= 1 / t;
     }
 
-    double length() const 
+    real length() const 
     {
         return sqrt(length_squared());
     }
 
-    double length_squared() const 
-    {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
-    }
+    real length_squared() const;
 
     bool near_zero() const 
     {
@@ -63,14 +65,14 @@ public:
         return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
     }
 
-    inline static vec3 random()
+    inline static vec3 random(rng& gen)
     {
-        return vec3(random_double(), random_double(), random_double());
+        return vec3(random_double(gen), random_double(gen), random_double(gen));
     }
 
-    inline static vec3 random(double min, double max)
+    inline static vec3 random(real min, real max, rng& gen)
     {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        return vec3(random_double(min, max, gen), random_double(min, max, gen), random_double(min, max, gen));
     }
 };
 
@@ -85,37 +87,121 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v)
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#if RT_VEC3_LANES == 4
+
+/// <summary>
+/// Register type and lane operations behind the SIMD vec3
+/// </summary>
+namespace vec3_lanes
+{
+#ifdef RT_FLOAT
+    using pack = __m128;
+
+    inline pack load(const vec3& v) { return _mm_load_ps(v.e); }
+    inline pack splat(real t) { return _mm_set1_ps(t); }
+    inline pack add(pack a, pack b) { return _mm_add_ps(a, b); }
+    inline pack sub(pack a, pack b) { return _mm_sub_ps(a, b); }
+    inline pack mul(pack a, pack b) { return _mm_mul_ps(a, b); }
+
+    inline vec3 store(pack p)
+    {
+        vec3 v;
+        _mm_store_ps(v.e, p);
+        return v;
+    }
+
+    // (x, y, z, 0) -> (y, z, x, 0)
+    inline pack rotate(pack a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+    inline real sum(pack a)
+    {
+        pack s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+#else
+    using pack = __m256d;
+
+    inline pack load(const vec3& v) { return _mm256_load_pd(v.e); }
+    inline pack splat(real t) { return _mm256_set1_pd(t); }
+    inline pack add(pack a, pack b) { return _mm256_add_pd(a, b); }
+    inline pack sub(pack a, pack b) { return _mm256_sub_pd(a, b); }
+    inline pack mul(pack a, pack b) { return _mm256_mul_pd(a, b); }
+
+    inline vec3 store(pack p)
+    {
+        vec3 v;
+        _mm256_store_pd(v.e, p);
+        return v;
+    }
+
+    // (x, y, z, 0) -> (y, z, x, 0)
+    inline pack rotate(pack a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+    inline real sum(pack a)
+    {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+#endif
+}
+
 inline vec3 operator+(const vec3& u, const vec3& v) 
 {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    return vec3_lanes::store(vec3_lanes::add(vec3_lanes::load(u), vec3_lanes::load(v)));
 }
 
 inline vec3 operator-(const vec3& u, const vec3& v) 
 {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    return vec3_lanes::store(vec3_lanes::sub(vec3_lanes::load(u), vec3_lanes::load(v)));
 }
 
 inline vec3 operator*(const vec3& u, const vec3& v) 
 {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    return vec3_lanes::store(vec3_lanes::mul(vec3_lanes::load(u), vec3_lanes::load(v)));
 }
 
-inline vec3 operator*(double t, const vec3& v) 
+inline vec3 operator*(real t, const vec3& v) 
 {
-    return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+    return vec3_lanes::store(vec3_lanes::mul(vec3_lanes::splat(t), vec3_lanes::load(v)));
 }
 
-inline vec3 operator*(const vec3& v, double t) 
+inline real dot(const vec3& u, const vec3& v) 
 {
-    return t * v;
+    return vec3_lanes::sum(vec3_lanes::mul(vec3_lanes::load(u), vec3_lanes::load(v)));
 }
 
-inline vec3 operator/(vec3 v, double t) 
+inline vec3 cross(const vec3& u, const vec3& v) 
 {
-    return (1 / t) * v;
+    // u x v = rotate(u * rotate(v) - rotate(u) * v)
+    auto a = vec3_lanes::load(u);
+    auto b = vec3_lanes::load(v);
+    auto c = vec3_lanes::sub(vec3_lanes::mul(a, vec3_lanes::rotate(b)), vec3_lanes::mul(vec3_lanes::rotate(a), b));
+    return vec3_lanes::store(vec3_lanes::rotate(c));
 }
 
-inline double dot(const vec3& u, const vec3& v) 
+#else
+
+inline vec3 operator+(const vec3& u, const vec3& v) 
+{
+    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+}
+
+inline vec3 operator-(const vec3& u, const vec3& v) 
+{
+    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+}
+
+inline vec3 operator*(const vec3& u, const vec3& v) 
+{
+    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+}
+
+inline vec3 operator*(real t, const vec3& v) 
+{
+    return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+}
+
+inline real dot(const vec3& u, const vec3& v) 
 {
     return u.e[0] * v.e[0]
         + u.e[1] * v.e[1]
@@ -129,33 +215,73 @@ inline vec3 cross(const vec3& u, const vec3& v)
         u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
+#endif
+
+inline vec3 operator*(const vec3& v, real t) 
+{
+    return t * v;
+}
+
+inline vec3 operator/(vec3 v, real t) 
+{
+    return (1 / t) * v;
+}
+
+inline vec3& vec3::operator+=(const vec3& v)
+{
+    return *this = *this + v;
+}
+
+inline vec3& vec3::operator*=(const real t)
+{
+    return *this = t * *this;
+}
+
+inline real vec3::length_squared() const
+{
+    return dot(*this, *this);
+}
+
 inline vec3 unit_vector(vec3 v)
 {
     return v / v.length();
 }
 
 /// <summary>
-/// Get a random point inside a unit sphere
+/// Relative luminance of a linear color (Rec. 709 weights)
 /// </summary>
-/// <returns></returns>
-vec3 random_in_unit_sphere()
+inline double luminance(const color& c)
 {
-    while (true)
-    {
-        auto p = vec3::random(-1, 1);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
 }
 
 /// <summary>
 /// Pick random points on the unit sphere (offset along the surface normal)
-/// For True Lambertian Reflection
+/// For True Lambertian Reflection. Maps two numbers to the sphere in
+/// closed form (uniform z and angle), so stratified and low-discrepancy
+/// samples stay well spread.
 /// </summary>
+/// <param name="gen">Random number generator</param>
 /// <returns>Random point on unit sphere along the surface normal</returns>
-vec3 random_unit_vector()
+vec3 random_unit_vector(rng& gen)
 {
-    return unit_vector(random_in_unit_sphere());
+    auto z = 1.0 - 2.0 * random_double(gen);
+    auto phi = 2.0 * pi * random_double(gen);
+    auto r = std::sqrt(std::fmax(0.0, 1.0 - z * z));
+
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+/// <summary>
+/// Get a random point inside a unit sphere: a direction scaled by the cube
+/// root of a third number, which spreads points uniformly by volume
+/// </summary>
+/// <param name="gen">Random number generator</param>
+/// <returns></returns>
+vec3 random_in_unit_sphere(rng& gen)
+{
+    vec3 direction = random_unit_vector(gen);
+    return std::cbrt(random_double(gen)) * direction;
 }
 
 /// <summary>
@@ -163,10 +289,11 @@ vec3 random_unit_vector()
 /// with no dependence on the angle from the normal
 /// </summary>
 /// <param name="normal">Object's normal</param>
+/// <param name="gen">Random number generator</param>
 /// <returns>Point in the same hemisphere as the normal</returns>
-vec3 random_in_hemisphere(const vec3& normal)
+vec3 random_in_hemisphere(const vec3& normal, rng& gen)
 {
-    vec3 in_unit_sphere = random_in_unit_sphere();
+    vec3 in_unit_sphere = random_in_unit_sphere(gen);
     
     // Check if point is in the same hemisphere as the normal
     if (dot(in_unit_sphere, normal) > 0.0)
@@ -181,19 +308,31 @@ vec3 random_in_hemisphere(const vec3& normal)
 
 /// <summary>
 /// Get a random point in a disk.
-/// Use for depth of field
+/// Use for depth of field. Uses the concentric mapping of the square to
+/// the disk (Shirley and Chiu), which keeps neighbouring samples close.
 /// </summary>
+/// <param name="gen">Random number generator</param>
 /// <returns>Point in disk</returns>
-vec3 random_in_unit_disk()
+vec3 random_in_unit_disk(rng& gen)
 {
-    while (true)
-    {
-        auto p = vec3(random_double(-1.0, 1.0), random_double(-1.0, 1.0), 0.0);
-
-        if (p.length_squared() >= 1.0) continue;
+    auto a = random_double(-1.0, 1.0, gen);
+    auto b = random_double(-1.0, 1.0, gen);
+    if (a == 0.0 && b == 0.0) return vec3(0.0, 0.0, 0.0);
 
-        return p;
+    const double quarter_pi = 0.25 * pi;
+    double r, phi;
+    if (std::fabs(a) > std::fabs(b))
+    {
+        r = a;
+        phi = quarter_pi * (b / a);
     }
+    else
+    {
+        r = b;
+        phi = 2.0 * quarter_pi - quarter_pi * (a / b);
+    }
+
+    return vec3(r * std::cos(phi), r * std::sin(phi), 0.0);
 }
 
 /// <summary>
@@ -215,7 +354,7 @@ vec3 reflect(const vec3& v, const vec3& n)
 /// <param name="n">Normal to surface</param>
 /// <param name="etai_by_etat">Division of indices of refraction</param>
 /// <returns></returns>
-vec3 refract(const vec3& uv, const vec3& n, double etai_by_etat)
+vec3 refract(const vec3& uv, const vec3& n, real etai_by_etat)
 {
     auto cos_theta = fmin(dot(-uv, n), 1.0); // Get angle between ray and normal
     
@@ -0,0 +1,322 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "environment.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "render_settings.h"
+#include "roulette.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Everything a path in flight carries between wavefront stages
+/// </summary>
+struct path_state
+{
+	ray r;
+	color throughput; // Product of the attenuations so far
+	color radiance;   // Light the path has gathered
+	rng gen;
+	hit_record rec;
+	int bounces; // Bounces made so far
+	real scatter_pdf; // Density of the last scattered direction if that bounce also aimed at a light
+	int pixel; // Pixel of the tile the path belongs to
+};
+
+/// <summary>
+/// Wavefront integrator. Instead of following one path to completion, it keeps
+/// a batch of paths and advances all of them one stage at a time:
+/// intersect every active path, bucket the hits by material type, then run
+/// each material's scatter over its contiguous bucket. Numbers are drawn from
+/// the same per-sample generators as ray_color, so both integrators trace the
+/// same paths.
+/// </summary>
+class wavefront_integrator
+{
+public:
+	/// <summary>
+	/// Render one pass of one tile
+	/// </summary>
+	/// <param name="t">Tile to render</param>
+	/// <param name="world">Hittable objects</param>
+	/// <param name="materials">Materials of the scene</param>
+	/// <param name="lights">Lights and sky of the scene</param>
+	/// <param name="cam">Camera</param>
+	/// <param name="settings">Render settings</param>
+	/// <param name="image">Framebuffer receiving the sample sums</param>
+	void render_tile(const tile& t, const hittable& world, const material_table& materials, const light_list& lights, const camera& cam,
+		const render_settings& settings, framebuffer& image)
+	{
+		max_depth = settings.max_depth;
+		roulette_depth = settings.roulette_depth;
+
+		int tile_width = t.x1 - t.x0;
+		int pixel_count = tile_width * (t.y1 - t.y0);
+
+		pixel_sums.assign(pixel_count, color(0.0, 0.0, 0.0));
+		pixel_luminance_sq.assign(pixel_count, 0.0);
+		first_sample.resize(pixel_count);
+		sample_count.resize(pixel_count);
+
+		for (int p = 0; p < pixel_count; ++p)
+		{
+			int i = t.x0 + p % tile_width;
+			int j = t.y0 + p / tile_width;
+			first_sample[p] = static_cast<int>(image.samples(i, j));
+			sample_count[p] = pass_sample_count(image, i, j, settings);
+		}
+
+		// Fill batches pixel by pixel, samples in order, so the sums are
+		// accumulated in the same order as the recursive integrator
+		int pixel = 0;
+		int sample = 0;
+
+		while (pixel < pixel_count)
+		{
+			paths.clear();
+			active.clear();
+
+			while (pixel < pixel_count && static_cast<int>(paths.size()) < settings.wavefront_batch)
+			{
+				if (sample >= sample_count[pixel])
+				{
+					pixel++;
+					sample = 0;
+					continue;
+				}
+
+				generate(t.x0 + pixel % tile_width, t.y0 + pixel / tile_width, pixel, first_sample[pixel] + sample, cam, settings);
+				sample++;
+			}
+
+			trace(world, materials, lights);
+
+			for (const auto& path : paths)
+			{
+				pixel_sums[path.pixel] += path.radiance;
+				pixel_luminance_sq[path.pixel] += luminance(path.radiance) * luminance(path.radiance);
+			}
+		}
+
+		for (int p = 0; p < pixel_count; ++p)
+		{
+			if (sample_count[p] > 0)
+			{
+				image.add(t.x0 + p % tile_width, t.y0 + p / tile_width, pixel_sums[p], pixel_luminance_sq[p], sample_count[p]);
+			}
+		}
+	}
+
+private:
+	int max_depth = 0;
+	int roulette_depth = 0;
+	std::vector<path_state> paths;
+	std::vector<color> pixel_sums;
+	std::vector<double> pixel_luminance_sq;
+	std::vector<int> first_sample;
+	std::vector<int> sample_count;
+	std::vector<int> active;
+	std::vector<int> next_active;
+	std::vector<int> hits;
+	std::vector<int> sorted;
+
+	/// <summary>
+	/// Stage 0: camera ray for one pixel sample
+	/// </summary>
+	void generate(int i, int j, int pixel, int s, const camera& cam, const render_settings& settings)
+	{
+		path_state path;
+		path.gen = pixel_rng(settings, i, j, s);
+
+		auto u = (i + random_double(path.gen)) / (settings.width - 1);
+		auto v = (j + random_double(path.gen)) / (settings.height - 1);
+
+		path.r = cam.get_ray(u, v, path.gen);
+		path.throughput = color(1.0, 1.0, 1.0);
+		path.radiance = color(0.0, 0.0, 0.0);
+		path.bounces = 0;
+		path.scatter_pdf = 0;
+		path.pixel = pixel;
+
+		active.push_back(static_cast<int>(paths.size()));
+		paths.push_back(path);
+	}
+
+	/// <summary>
+	/// Advance the batch until every path has escaped or been absorbed or terminated
+	/// </summary>
+	void trace(const hittable& world, const material_table& materials, const light_list& lights)
+	{
+		while (!active.empty())
+		{
+			intersect(world, lights);
+			sort_by_material(materials);
+			shade(world, materials, lights);
+
+			std::swap(active, next_active);
+		}
+	}
+
+	/// <summary>
+	/// Stage 1: closest hit for every active path. Escaping paths pick up the
+	/// sky, as do paths out of bounces, like in ray_color.
+	/// </summary>
+	void intersect(const hittable& world, const light_list& lights)
+	{
+		hits.clear();
+
+		for (int index : active)
+		{
+			path_state& path = paths[index];
+
+			if (path.bounces >= max_depth)
+			{
+				RT_STAT(thread_stats().end_path(path.bounces));
+				path.radiance += path.throughput * lights.sky(path.r) * sky_weight(lights, path.scatter_pdf, path.r);
+				continue;
+			}
+
+			RT_STAT(thread_stats().trace_ray(path.bounces));
+			if (world.hit(path.r, 0.001, infinity, path.rec))
+			{
+				hits.push_back(index);
+			}
+			else
+			{
+				RT_STAT(thread_stats().end_path(path.bounces + 1));
+				path.radiance += path.throughput * lights.sky(path.r) * sky_weight(lights, path.scatter_pdf, path.r);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Stage 2: counting sort of the hits by material type
+	/// </summary>
+	void sort_by_material(const material_table& materials)
+	{
+		int offsets[material_kind_count + 1] = {};
+
+		for (int index : hits)
+		{
+			offsets[static_cast<int>(materials[paths[index].rec.mat_id].kind()) + 1]++;
+		}
+
+		for (int k = 0; k < material_kind_count; ++k)
+		{
+			offsets[k + 1] += offsets[k];
+		}
+
+		sorted.resize(hits.size());
+		for (int index : hits)
+		{
+			sorted[offsets[static_cast<int>(materials[paths[index].rec.mat_id].kind())]++] = index;
+		}
+	}
+
+	/// <summary>
+	/// Stage 3: run each material's scatter over its bucket, aim at lights
+	/// from diffuse surfaces and extend the surviving paths
+	/// </summary>
+	void shade(const hittable& world, const material_table& materials, const light_list& lights)
+	{
+		next_active.clear();
+
+		size_t begin = 0;
+		begin = scatter_batch<lambertian>(world, materials, lights, begin, material_kind::lambertian);
+		begin = scatter_batch<metal>(world, materials, lights, begin, material_kind::metal);
+		begin = scatter_batch<dielectric>(world, materials, lights, begin, material_kind::dielectric);
+		begin = scatter_batch<diffuse_light>(world, materials, lights, begin, material_kind::diffuse_light);
+	}
+
+	/// <summary>
+	/// Scatter a run of paths that all hit the same material type,
+	/// calling that type's scatter directly instead of switching per path.
+	/// </summary>
+	/// <param name="world">Hittable objects, for shadow rays</param>
+	/// <param name="materials">Materials of the scene</param>
+	/// <param name="lights">Lights and sky of the scene</param>
+	/// <param name="begin">First sorted entry of the run</param>
+	/// <param name="kind">Material type of the run</param>
+	/// <returns>First sorted entry after the run</returns>
+	template <typename Material>
+	size_t scatter_batch(const hittable& world, const material_table& materials, const light_list& lights, size_t begin, material_kind kind)
+	{
+		size_t i = begin;
+
+		for (; i < sorted.size(); ++i)
+		{
+			path_state& path = paths[sorted[i]];
+			const material& m = materials[path.rec.mat_id];
+			if (m.kind() != kind) break;
+
+			const Material& mat = m.as<Material>();
+
+			ray scattered;
+			color attenuation;
+
+			if constexpr (std::is_same<Material, diffuse_light>::value)
+			{
+				path.radiance += path.throughput * mat.emitted(path.rec) * emission_weight(lights, path.scatter_pdf, path.r, path.rec);
+			}
+
+			path.gen.next_bounce();
+
+			bool scatters = mat.scatter(path.r, path.rec, attenuation, scattered, path.gen);
+			RT_STAT(thread_stats().hit_material(static_cast<int>(kind), scatters));
+
+			if (scatters)
+			{
+				path.scatter_pdf = 0;
+				if constexpr (std::is_same<Material, lambertian>::value)
+				{
+					if (!lights.empty())
+					{
+						path.radiance += path.throughput * sample_direct_light(lights, world, path.rec, attenuation, path.r.time(), path.gen);
+						path.scatter_pdf = lambertian_pdf(path.rec, scattered.direction());
+					}
+				}
+
+				path.throughput = path.throughput * attenuation;
+				path.r = scattered;
+				path.bounces++;
+
+				if (russian_roulette(path.throughput, path.bounces, roulette_depth, path.gen))
+				{
+					next_active.push_back(sorted[i]);
+				}
+				else
+				{
+					RT_STAT(thread_stats().end_path(path.bounces));
+				}
+			}
+			else
+			{
+				RT_STAT(thread_stats().end_path(path.bounces + 1));
+			}
+		}
+
+		return i;
+	}
+};
+
+/// <summary>
+/// Render a tile with the calling thread's wavefront integrator,
+/// which keeps its path buffers between tiles
+/// </summary>
+inline void render_tile_wavefront(const tile& t, const hittable& world, const material_table& materials, const light_list& lights, const camera& cam,
+	const render_settings& settings, framebuffer& image)
+{
+	static thread_local wavefront_integrator state;
+	state.render_tile(t, world, materials, lights, cam, settings, image);
+}
+
+#endif // !WAVEFRONT_H